@@ -53,6 +53,10 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t, size_t cnt,
+                       void *const buffers[]);
+void block_write_multi (struct block *, block_sector_t, size_t cnt,
+                        const void *const buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
@@ -65,6 +69,14 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Transfer CNT consecutive sectors, each to or from its own
+       buffer, as one request if the device can.  Optional: if
+       null, the block layer calls read or write per sector. */
+    void (*read_multi) (void *aux, block_sector_t, size_t cnt,
+                        void *const buffers[]);
+    void (*write_multi) (void *aux, block_sector_t, size_t cnt,
+                         const void *const buffers[]);
   };
 
 struct block *block_register (const char *name, enum block_type,
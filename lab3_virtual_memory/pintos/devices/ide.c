@@ -1,6 +1,7 @@
 #include "devices/ide.h"
 #include <ctype.h>
 #include <debug.h>
+#include <list.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
@@ -8,10 +9,27 @@
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the controller is a PCI bus master, as is the PIIX that
+   QEMU emulates, and a disk supports DMA, transfers to and from
+   that disk use DMA: the controller copies the data to or from
+   memory by itself and interrupts once at the end, following the
+   bus master programming interface [BMIDE].  Otherwise, the CPU
+   copies the data through the data register with programmed I/O
+   (PIO).
+
+   Each transfer is a request queued on its channel.  The request
+   at the front of the queue owns the channel.  The interrupt
+   handler completes a DMA request and starts the next one, so
+   the requesting threads only sleep until their own request is
+   done.  A PIO request is instead handed to its thread, which
+   does the transfer and then starts the next request. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +52,20 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus master register offsets from a channel's BM_BASE. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of PRD table. */
+
+/* Bus master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Direction: 0=to disk, 1=to memory. */
+
+/* Bus master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Error; write 1 to clear. */
+#define BM_STA_INTR 0x04        /* Interrupt; write 1 to clear. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +81,35 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors transferred by one command (a sector count of 0
+   means 256). */
+#define MAX_SECTORS_PER_COMMAND 256
+
+/* Most sectors per interrupt that we ask a disk for in multiple
+   mode.  QEMU supports 16. */
+#define MAX_MULTIPLE 16
+
+/* A Physical Region Descriptor: a physically contiguous piece
+   of the memory of a DMA transfer, which must not cross a 64 kB
+   boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, with 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Descriptors in the page that holds a channel's PRD table.  A
+   transfer needs at most two per sector. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +118,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Transfer by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -67,7 +131,14 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
+    uint16_t bm_base;           /* Bus master I/O base, or 0 if none. */
+    struct prd *prd_table;      /* PRD table for DMA, one page. */
+
+    /* Requests, of which the first owns the channel.  Protected
+       by disabling interrupts. */
+    struct list requests;
+    bool dma_active;            /* Is the first request's DMA running? */
+
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
@@ -79,13 +150,43 @@ struct channel
 #define CHANNEL_CNT 2
 static struct channel channels[CHANNEL_CNT];
 
+/* A transfer of up to MAX_SECTORS_PER_COMMAND sectors, queued on
+   a channel. */
+struct ide_request
+  {
+    struct list_elem elem;      /* Element in channel's requests. */
+    struct ata_disk *disk;      /* Disk to transfer to or from. */
+    block_sector_t sec_no;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *const *buffers;       /* One buffer per sector. */
+    bool write;                 /* Write to disk (else read)? */
+    bool dma;                   /* Transfer by DMA (else PIO)? */
+    bool ok;                    /* Did the DMA transfer succeed? */
+    struct semaphore done;      /* Up'd when the DMA transfer is over
+                                   or the channel is handed over. */
+  };
+
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
-
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int multiple);
+
+static void transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                      void *const buffers[], bool write);
+static void submit_request (struct ide_request *);
+static void start_request (struct channel *);
+static void finish_request (struct channel *);
+static bool dma_capable (void *const buffers[], size_t cnt);
+static void start_dma (struct channel *, struct ide_request *);
+static void complete_dma (struct channel *);
+static void pio_read (struct ide_request *);
+static void pio_write (struct ide_request *);
+
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -101,6 +202,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = find_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -123,7 +225,20 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      if (bm_base != 0)
+        {
+          /* The secondary channel's registers follow the
+             primary's. */
+          c->bm_base = bm_base + 8 * chan_no;
+          c->prd_table = palloc_get_page (PAL_ASSERT);
+        }
+      else
+        {
+          c->bm_base = 0;
+          c->prd_table = NULL;
+        }
+      list_init (&c->requests);
+      c->dma_active = false;
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
  
@@ -136,6 +251,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -155,6 +272,77 @@ ide_init (void)
     }
 }
 
+/* Bus master detection. */
+
+/* PCI configuration space access mechanism #1 [PCI]. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* PCI configuration registers. */
+#define PCI_ID 0x00             /* Vendor ID, Device ID. */
+#define PCI_COMMAND 0x04        /* Command, Status. */
+#define PCI_CLASS 0x08          /* Revision, Prog IF, Subclass, Class. */
+#define PCI_BAR4 0x20           /* Base Address Register 4. */
+
+/* PCI Command Register bits. */
+#define PCI_CMD_IO 0x0001       /* Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /* Act as bus master. */
+
+/* Returns register REG of function FUNC of device DEV on PCI bus
+   0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to register REG of function FUNC of device DEV on
+   PCI bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller that can be a bus
+   master and drives the legacy channels, as the PIIX in a
+   standard PC does.  If there is one, enables it as a bus master
+   and returns its bus master I/O base, otherwise returns 0. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar, command;
+
+        if ((pci_read_config (dev, func, PCI_ID) & 0xffff) == 0xffff)
+          continue;
+
+        /* Mass storage (0x01) IDE (0x01) controller, bus master
+           capable (0x80), both channels in compatibility mode
+           (0x05 clear). */
+        class = pci_read_config (dev, func, PCI_CLASS) >> 8;
+        if ((class >> 8) != 0x0101 || (class & 0x85) != 0x80)
+          continue;
+
+        /* The bus master registers are in I/O space. */
+        bar = pci_read_config (dev, func, PCI_BAR4);
+        if ((bar & 1) == 0 || (bar & 0xfffc) == 0)
+          continue;
+
+        command = pci_read_config (dev, func, PCI_COMMAND) & 0xffff;
+        pci_write_config (dev, func, PCI_COMMAND,
+                          command | PCI_CMD_IO | PCI_CMD_MASTER);
+        return bar & 0xfffc;
+      }
+  return 0;
+}
+
 /* Disk detection and identification. */
 
 static char *descramble_ata_string (char *, int size);
@@ -265,6 +453,7 @@ identify_ata_device (struct ata_disk *d)
   char *model, *serial;
   char extra_info[128];
   struct block *block;
+  int multiple;
 
   ASSERT (d->is_ata);
 
@@ -281,9 +470,11 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Calculate capacity and the most sectors per interrupt the
+     disk supports.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  multiple = *(uint8_t *) &id[47 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -303,12 +494,35 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Transfer several sectors per interrupt if the disk can, and
+     by DMA if both the disk (word 49, bit 8) and the controller
+     can. */
+  if (multiple > 1)
+    set_multiple_mode (d, multiple < MAX_MULTIPLE ? multiple : MAX_MULTIPLE);
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
   partition_scan (block);
 }
 
+/* Asks disk D to transfer MULTIPLE sectors per interrupt in
+   READ MULTIPLE and WRITE MULTIPLE commands, and records in D
+   whether it agreed. */
+static void
+set_multiple_mode (struct ata_disk *d, int multiple)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  d->multiple = (inb (reg_status (c)) & STA_ERR) == 0 ? multiple : 0;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,63 +551,307 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
+/* Reads the CNT sectors starting at SEC_NO from disk D, each into
+   the corresponding element of BUFFERS, which must have room for
+   BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read_multi (void *d, block_sector_t sec_no, size_t cnt,
+                void *const buffers[])
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  transfer (d, sec_no, cnt, buffers, false);
 }
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
+/* Writes the CNT sectors starting at SEC_NO to disk D, each from
+   the corresponding element of BUFFERS, which must contain
    BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
    acknowledged receiving the data.
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write_multi (void *d, block_sector_t sec_no, size_t cnt,
+                 const void *const buffers[])
+{
+  transfer (d, sec_no, cnt, (void *const *) buffers, true);
+}
+
+/* Transfers the CNT sectors starting at SEC_NO between disk D and
+   BUFFERS, one buffer per sector, writing them to D if WRITE is
+   true and reading them otherwise.  Issues one request per
+   MAX_SECTORS_PER_COMMAND sectors, by DMA if D and the buffers
+   allow it.  If a DMA transfer fails, turns DMA off for D and
+   retries with PIO. */
+static void
+transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+          void *const buffers[], bool write)
+{
+  while (cnt > 0)
+    {
+      struct ide_request req;
+      size_t cmd_cnt = cnt < MAX_SECTORS_PER_COMMAND
+                       ? cnt : MAX_SECTORS_PER_COMMAND;
+
+      req.disk = d;
+      req.sec_no = sec_no;
+      req.cnt = cmd_cnt;
+      req.buffers = buffers;
+      req.write = write;
+      req.dma = d->dma && dma_capable (buffers, cmd_cnt);
+      submit_request (&req);
+      if (req.dma && !req.ok)
+        {
+          printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+                  d->name, write ? "write" : "read", sec_no);
+          d->dma = false;
+          req.dma = false;
+          submit_request (&req);
+        }
+      if (!req.dma)
+        {
+          if (write)
+            pio_write (&req);
+          else
+            pio_read (&req);
+          finish_request (d->channel);
+        }
+
+      sec_no += cmd_cnt;
+      buffers += cmd_cnt;
+      cnt -= cmd_cnt;
+    }
+}
+
+/* Queues REQ on its disk's channel and waits until, for a DMA
+   request, the transfer is over, or, for a PIO request, the
+   channel is ours.  In the latter case the caller must do the
+   transfer and then call finish_request(). */
+static void
+submit_request (struct ide_request *req)
+{
+  struct channel *c = req->disk->channel;
+  enum intr_level old_level;
+
+  sema_init (&req->done, 0);
+  old_level = intr_disable ();
+  list_push_back (&c->requests, &req->elem);
+  if (list_front (&c->requests) == &req->elem)
+    start_request (c);
+  intr_set_level (old_level);
+
+  sema_down (&req->done);
+}
+
+/* Starts the request at the front of channel C's queue, which
+   must not be empty: starts its DMA transfer or hands the
+   channel over to its thread.  Interrupts must be off. */
+static void
+start_request (struct channel *c)
+{
+  struct ide_request *req = list_entry (list_front (&c->requests),
+                                        struct ide_request, elem);
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  if (req->dma)
+    start_dma (c, req);
+  else
+    sema_up (&req->done);
+}
+
+/* Removes the PIO request at the front of channel C's queue,
+   whose transfer is over, and starts the next request, if any. */
+static void
+finish_request (struct channel *c)
+{
+  enum intr_level old_level = intr_disable ();
+
+  list_pop_front (&c->requests);
+  if (!list_empty (&c->requests))
+    start_request (c);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the CNT buffers in BUFFERS can be transferred
+   by DMA, which moves 16-bit words. */
+static bool
+dma_capable (void *const buffers[], size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if ((uintptr_t) buffers[i] & 1)
+      return false;
+  return true;
+}
+
+/* Describes the buffers of REQ in channel C's PRD table, merging
+   buffers that are physically contiguous, and starts the DMA
+   transfer.  Interrupts must be off. */
+static void
+start_dma (struct channel *c, struct ide_request *req)
+{
+  struct prd *prd = c->prd_table;
+  uint8_t direction = req->write ? 0 : BM_CMD_READ;
+  size_t i;
+
+  for (i = 0; i < req->cnt; i++)
+    {
+      uintptr_t addr = vtop (req->buffers[i]);
+      size_t size = BLOCK_SECTOR_SIZE;
+
+      while (size > 0)
+        {
+          size_t chunk = 0x10000 - (addr & 0xffff);
+          if (chunk > size)
+            chunk = size;
+
+          if (prd > c->prd_table && prd[-1].addr + prd[-1].size == addr
+              && (addr & 0xffff) != 0 && prd[-1].size + chunk < 0x10000)
+            prd[-1].size += chunk;
+          else
+            {
+              ASSERT (prd < c->prd_table + PRD_CNT);
+              prd->addr = addr;
+              prd->size = chunk;
+              prd->flags = 0;
+              prd++;
+            }
+          addr += chunk;
+          size -= chunk;
+        }
+    }
+  prd[-1].flags = PRD_EOT;
+
+  outl (c->bm_base + BM_PRDT, vtop (c->prd_table));
+  outb (c->bm_base + BM_COMMAND, direction);
+  outb (c->bm_base + BM_STATUS,
+        inb (c->bm_base + BM_STATUS) | BM_STA_ERR | BM_STA_INTR);
+  select_sectors (req->disk, req->sec_no, req->cnt);
+  c->dma_active = true;
+  outb (reg_command (c), req->write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (c->bm_base + BM_COMMAND, direction | BM_CMD_START);
+}
+
+/* Completes the DMA request at the front of channel C's queue,
+   wakes up its thread, and starts the next request, if any.
+   Called by the interrupt handler. */
+static void
+complete_dma (struct channel *c)
+{
+  struct ide_request *req;
+  uint8_t bm_status = inb (c->bm_base + BM_STATUS);
+  uint8_t status;
+
+  /* Not from our controller. */
+  if ((bm_status & BM_STA_INTR) == 0)
+    return;
+
+  outb (c->bm_base + BM_COMMAND, 0);            /* Stop transfer. */
+  status = inb (reg_status (c));                /* Acknowledge interrupt. */
+  outb (c->bm_base + BM_STATUS, bm_status | BM_STA_ERR | BM_STA_INTR);
+  c->dma_active = false;
+
+  req = list_entry (list_pop_front (&c->requests), struct ide_request, elem);
+  req->ok = (bm_status & BM_STA_ERR) == 0 && (status & STA_ERR) == 0;
+  sema_up (&req->done);
+
+  if (!list_empty (&c->requests))
+    start_request (c);
+}
+
+/* Reads the sectors of REQ with PIO.  Issues one command, which
+   in multiple mode interrupts once per D->multiple sectors
+   instead of once per sector.  The channel must be ours. */
+static void
+pio_read (struct ide_request *req)
 {
-  struct ata_disk *d = d_;
+  struct ata_disk *d = req->disk;
   struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+  size_t i;
+
+  select_sectors (d, req->sec_no, req->cnt);
+  issue_pio_command (c, d->multiple > 0
+                        ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < req->cnt; i++)
+    {
+      if (i % per_intr == 0)
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, req->sec_no + i);
+        }
+      input_sector (c, req->buffers[i]);
+    }
+}
+
+/* Writes the sectors of REQ with PIO, with as few interrupts as
+   pio_read().  Returns after the disk has acknowledged receiving
+   the data.  The channel must be ours. */
+static void
+pio_write (struct ide_request *req)
+{
+  struct ata_disk *d = req->disk;
+  struct channel *c = d->channel;
+  size_t per_intr = d->multiple > 0 ? d->multiple : 1;
+  size_t i;
+
+  select_sectors (d, req->sec_no, req->cnt);
+  issue_pio_command (c, d->multiple > 0
+                        ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < req->cnt; i++)
+    {
+      /* The disk asks for each block of PER_INTR sectors in turn
+         and interrupts once it has taken it. */
+      if (i % per_intr == 0 && !wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu,
+               d->name, req->sec_no + i);
+      output_sector (c, req->buffers[i]);
+      if (i % per_intr == per_intr - 1 || i == req->cnt - 1)
+        sema_down (&c->completion_wait);
+    }
+}
+
+/* Reads sector SEC_NO from disk D into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ide_read (void *d, block_sector_t sec_no, void *buffer)
+{
+  ide_read_multi (d, sec_no, 1, &buffer);
+}
+
+/* Write sector SEC_NO to disk D from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving the data. */
+static void
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multi (d, sec_no, 1, &buffer);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multi,
+    ide_write_multi
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be at most
+   MAX_SECTORS_PER_COMMAND, to the disk's sector selection
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (sec_no + cnt <= (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -434,6 +892,7 @@ output_sector (struct channel *c, const void *sector)
 
 /* Wait up to 10 seconds for the controller to become idle, that
    is, for the BSY and DRQ bits to clear in the status register.
+   Busy-waits, so that the interrupt handler may use it too.
 
    As a side effect, reading the status register clears any
    pending interrupt. */
@@ -446,7 +905,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,7 +938,8 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
-/* Program D's channel so that D is now the selected disk. */
+/* Program D's channel so that D is now the selected disk.
+   Busy-waits, so that the interrupt handler may use it too. */
 static void
 select_device (const struct ata_disk *d)
 {
@@ -489,7 +949,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -511,7 +971,9 @@ interrupt_handler (struct intr_frame *f)
   for (c = channels; c < channels + CHANNEL_CNT; c++)
     if (f->vec_no == c->irq)
       {
-        if (c->expecting_interrupt) 
+        if (c->dma_active)
+          complete_dma (c);
+        else if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
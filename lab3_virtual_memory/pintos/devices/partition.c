@@ -317,8 +317,30 @@ partition_write (void *p_, block_sector_t sector, const void *buffer)
   block_write (p->block, p->start + sector, buffer);
 }
 
+/* Reads the CNT sectors starting at SECTOR from partition P into
+   BUFFERS, one sector per buffer. */
+static void
+partition_read_multi (void *p_, block_sector_t sector, size_t cnt,
+                      void *const buffers[])
+{
+  struct partition *p = p_;
+  block_read_multi (p->block, p->start + sector, cnt, buffers);
+}
+
+/* Writes the CNT sectors starting at SECTOR to partition P from
+   BUFFERS, one sector per buffer. */
+static void
+partition_write_multi (void *p_, block_sector_t sector, size_t cnt,
+                       const void *const buffers[])
+{
+  struct partition *p = p_;
+  block_write_multi (p->block, p->start + sector, cnt, buffers);
+}
+
 static struct block_operations partition_operations =
   {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_multi,
+    partition_write_multi
   };
@@ -0,0 +1,482 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Buffer cache.
+
+   All file system sectors are read and written through a cache
+   of CACHE_SECTORS sectors, replaced by the clock algorithm.
+   Writes only dirty the cached copy.  A background thread writes
+   dirty sectors back every FLUSH_TICKS, and filesys_done() writes
+   back the rest, so repeated writes to a sector, such as those
+   of the free map and of directories, reach the disk once.
+   Sectors that are next to each other on disk are read in and
+   written back up to CACHE_RUN_SECTORS at a time, with one
+   request to the disk each.  Reads queue the run of sectors that
+   follows for another background thread to read in, so that
+   sequential reads seldom wait for the disk.
+
+   CACHE_LOCK protects the mapping from sectors to entries, the
+   clock hand, the read-ahead queue, and each entry's SECTOR,
+   PIN_CNT and ACCESSED.  Each entry's own lock protects its
+   data, VALID and DIRTY, and is held while the entry is read in
+   or written back.  A thread pins an entry before it acquires
+   the entry's lock and unpins it after releasing it, and never
+   waits for an entry's lock while holding CACHE_LOCK.  An entry
+   that is not pinned is therefore not locked either, and is only
+   reused if it is clean, so that a sector being written back is
+   still found in the cache by the threads that want it.  A
+   thread that holds several entries either takes their locks in
+   order of increasing sector or only takes entries that were not
+   pinned, whose locks are free. */
+
+/* Number of cached sectors. */
+#define CACHE_SECTORS 64
+
+/* Ticks between write-behinds of dirty sectors. */
+#define FLUSH_TICKS TIMER_FREQ
+
+/* Maximum number of runs of sectors queued for read-ahead. */
+#define READ_AHEAD_MAX 16
+
+/* Sector number of an unused entry. */
+#define NO_SECTOR ((block_sector_t) -1)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    block_sector_t sector;              /* Sector held, or NO_SECTOR. */
+    int pin_cnt;                        /* Threads using the entry. */
+    bool accessed;                      /* Used since clock hand passed. */
+    bool prefetched;                    /* Read in for a read that counted
+                                           it as a miss already. */
+
+    struct lock lock;                   /* Protects the members below. */
+    bool valid;                         /* DATA has been read in. */
+    bool dirty;                         /* DATA differs from the disk. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SECTORS];
+static struct lock cache_lock;
+static struct condition unpinned;       /* Signaled when an entry's
+                                           pin count drops to 0. */
+static size_t clock_hand;
+
+/* Runs of sectors to read ahead. */
+struct read_ahead_run
+  {
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+static struct read_ahead_run read_ahead_queue[READ_AHEAD_MAX];
+static size_t read_ahead_head, read_ahead_cnt;
+static struct condition read_ahead_ready;
+
+/* Statistics. */
+static long long hit_cnt;               /* Accesses found in the cache. */
+static long long miss_cnt;              /* Accesses that had to load. */
+static long long ahead_cnt;             /* Sectors read ahead. */
+static long long write_back_cnt;        /* Dirty sectors written back. */
+
+static struct cache_entry *acquire_entry (block_sector_t, bool load);
+static void release_entry (struct cache_entry *);
+static void prefetch (block_sector_t, size_t cnt, bool ahead);
+static size_t load_run (block_sector_t, size_t cnt, bool ahead);
+static struct cache_entry *lookup (block_sector_t);
+static struct cache_entry *try_evict (bool write);
+static void write_run (struct cache_entry *[], size_t cnt);
+static void write_behind (void *aux);
+static void read_ahead (void *aux);
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void)
+{
+  size_t i;
+
+  lock_init (&cache_lock);
+  cond_init (&unpinned);
+  cond_init (&read_ahead_ready);
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      cache[i].sector = NO_SECTOR;
+      lock_init (&cache[i].lock);
+    }
+
+  thread_create ("write-behind", PRI_DEFAULT, write_behind, NULL);
+  thread_create ("read-ahead", PRI_DEFAULT, read_ahead, NULL);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR of the file system
+   device into BUFFER. */
+void
+cache_read (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+  e = acquire_entry (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  release_entry (e);
+}
+
+/* Writes SIZE bytes from BUFFER to offset OFS of SECTOR of the
+   file system device.  The data reaches the disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+  e = acquire_entry (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->valid = true;
+  e->dirty = true;
+  release_entry (e);
+}
+
+/* Reads into the cache those of the CNT sectors starting at
+   SECTOR that it does not hold yet, with one request per run of
+   up to CACHE_RUN_SECTORS missing sectors.  For a caller that is
+   about to read the sectors: they count as misses. */
+void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+  prefetch (sector, cnt, false);
+}
+
+/* Asks for the CNT sectors starting at SECTOR to be read into
+   the cache in the background, unless too many requests are
+   pending. */
+void
+cache_read_ahead (block_sector_t sector, size_t cnt)
+{
+  lock_acquire (&cache_lock);
+  if (read_ahead_cnt < READ_AHEAD_MAX)
+    {
+      struct read_ahead_run *r;
+
+      r = &read_ahead_queue[(read_ahead_head + read_ahead_cnt++)
+                            % READ_AHEAD_MAX];
+      r->sector = sector;
+      r->cnt = cnt;
+      cond_signal (&read_ahead_ready, &cache_lock);
+    }
+  lock_release (&cache_lock);
+}
+
+/* Writes every dirty sector back to disk, together with the
+   dirty sectors that follow it on disk. */
+void
+cache_flush (void)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SECTORS; i++)
+    {
+      struct cache_entry *run[CACHE_RUN_SECTORS];
+      size_t cnt;
+
+      /* Lock the run of dirty sectors that starts with the one in
+         entry I, in increasing order. */
+      for (cnt = 0; cnt < CACHE_RUN_SECTORS; cnt++)
+        {
+          struct cache_entry *e;
+
+          lock_acquire (&cache_lock);
+          e = cnt == 0 ? &cache[i] : lookup (run[0]->sector + cnt);
+          if (e == NULL || e->sector == NO_SECTOR)
+            {
+              lock_release (&cache_lock);
+              break;
+            }
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+
+          lock_acquire (&e->lock);
+          if (!e->dirty)
+            {
+              release_entry (e);
+              break;
+            }
+          run[cnt] = e;
+        }
+
+      if (cnt > 0)
+        {
+          size_t j;
+
+          write_run (run, cnt);
+          for (j = 0; j < cnt; j++)
+            release_entry (run[j]);
+        }
+    }
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  printf ("Buffer cache: %lld hits, %lld misses, %lld sectors read ahead, "
+          "%lld written back\n",
+          hit_cnt, miss_cnt, ahead_cnt, write_back_cnt);
+}
+
+/* Returns the entry for SECTOR, pinned and locked, putting
+   SECTOR in the cache if need be.  If LOAD is true, the entry's
+   data is read in if it is not valid yet; otherwise the caller
+   must overwrite all of it. */
+static struct cache_entry *
+acquire_entry (block_sector_t sector, bool load)
+{
+  struct cache_entry *e;
+
+  ASSERT (sector != NO_SECTOR);
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = lookup (sector);
+      if (e != NULL)
+        {
+          if (e->prefetched)
+            e->prefetched = false;
+          else
+            hit_cnt++;
+          break;
+        }
+
+      /* try_evict() may have to drop CACHE_LOCK, and another
+         thread may bring in SECTOR meanwhile, so look again each
+         time it fails. */
+      e = try_evict (true);
+      if (e != NULL)
+        {
+          miss_cnt++;
+          e->sector = sector;
+          e->valid = false;
+          e->prefetched = false;
+          break;
+        }
+    }
+  e->pin_cnt++;
+  e->accessed = true;
+  lock_release (&cache_lock);
+
+  lock_acquire (&e->lock);
+  if (load && !e->valid)
+    {
+      block_read (fs_device, sector, e->data);
+      e->valid = true;
+    }
+  return e;
+}
+
+/* Unlocks and unpins entry E. */
+static void
+release_entry (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  ASSERT (e->pin_cnt > 0);
+  if (--e->pin_cnt == 0)
+    cond_signal (&unpinned, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Reads into the cache the sectors of the CNT starting at SECTOR
+   that it does not hold yet, as cache_prefetch(), counting them as
+   read ahead if AHEAD is true and as misses otherwise. */
+static void
+prefetch (block_sector_t sector, size_t cnt, bool ahead)
+{
+  while (cnt > 0)
+    {
+      size_t loaded = load_run (sector, (cnt < CACHE_RUN_SECTORS
+                                         ? cnt : CACHE_RUN_SECTORS),
+                                ahead);
+      if (loaded == 0)
+        loaded = 1;
+      sector += loaded;
+      cnt -= loaded;
+    }
+}
+
+/* Reads in, with one request, the sectors from SECTOR up to the
+   first one that is already cached, at most CNT of them.  Stops
+   early if no clean entry is free for the next sector.  Counts
+   the sectors as read ahead if AHEAD is true, otherwise as misses
+   that their next access does not count again.  Returns the
+   number of sectors read, which is 0 if SECTOR is cached. */
+static size_t
+load_run (block_sector_t sector, size_t cnt, bool ahead)
+{
+  struct cache_entry *run[CACHE_RUN_SECTORS];
+  void *buffers[CACHE_RUN_SECTORS];
+  size_t n, i;
+
+  ASSERT (cnt <= CACHE_RUN_SECTORS);
+  lock_acquire (&cache_lock);
+  for (n = 0; n < cnt; n++)
+    {
+      struct cache_entry *e;
+
+      /* Only the first entry may be waited for, because the
+         others are taken while holding it.  As in
+         acquire_entry(), look again after each wait. */
+      do
+        e = lookup (sector + n) == NULL ? try_evict (n == 0) : NULL;
+      while (e == NULL && n == 0 && lookup (sector) == NULL);
+      if (e == NULL)
+        break;
+
+      e->sector = sector + n;
+      e->valid = false;
+      e->prefetched = !ahead;
+      e->pin_cnt++;
+      e->accessed = true;
+
+      /* E was not pinned, so its lock is free. */
+      lock_acquire (&e->lock);
+      run[n] = e;
+      buffers[n] = e->data;
+    }
+  if (ahead)
+    ahead_cnt += n;
+  else
+    miss_cnt += n;
+  lock_release (&cache_lock);
+
+  if (n > 0)
+    {
+      block_read_multi (fs_device, sector, n, buffers);
+      for (i = 0; i < n; i++)
+        {
+          run[i]->valid = true;
+          release_entry (run[i]);
+        }
+    }
+  return n;
+}
+
+/* Returns the entry that holds SECTOR, or a null pointer if
+   SECTOR is not cached.  CACHE_LOCK must be held. */
+static struct cache_entry *
+lookup (block_sector_t sector)
+{
+  size_t i;
+
+  for (i = 0; i < CACHE_SECTORS; i++)
+    if (cache[i].sector == sector)
+      return &cache[i];
+  return NULL;
+}
+
+/* Advances the clock hand to a clean entry that is not pinned
+   and returns it, still holding CACHE_LOCK throughout.  If WRITE
+   is false, passes over dirty entries and returns a null pointer
+   if there is no such entry.  Otherwise, if the hand comes to a
+   dirty entry first, writes it back, or if all entries are
+   pinned, waits for one to be unpinned, and returns a null
+   pointer; in both cases CACHE_LOCK is released in the meantime.
+   CACHE_LOCK must be held. */
+static struct cache_entry *
+try_evict (bool write)
+{
+  size_t i;
+
+  for (i = 0; i < 2 * CACHE_SECTORS; i++)
+    {
+      struct cache_entry *e = &cache[clock_hand];
+
+      clock_hand = (clock_hand + 1) % CACHE_SECTORS;
+      if (e->pin_cnt > 0)
+        continue;
+      if (e->accessed)
+        {
+          e->accessed = false;
+          continue;
+        }
+      if (!e->dirty)
+        return e;
+      if (!write)
+        continue;
+
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        write_run (&e, 1);
+      lock_release (&e->lock);
+      lock_acquire (&cache_lock);
+      if (--e->pin_cnt == 0)
+        cond_signal (&unpinned, &cache_lock);
+      return NULL;
+    }
+
+  if (write)
+    cond_wait (&unpinned, &cache_lock);
+  return NULL;
+}
+
+/* Writes the CNT entries in RUN, which hold consecutive dirty
+   sectors in order, back to disk with one request.  The entries'
+   locks must be held. */
+static void
+write_run (struct cache_entry *run[], size_t cnt)
+{
+  const void *buffers[CACHE_RUN_SECTORS];
+  size_t i;
+
+  ASSERT (cnt > 0 && cnt <= CACHE_RUN_SECTORS);
+  for (i = 0; i < cnt; i++)
+    {
+      ASSERT (lock_held_by_current_thread (&run[i]->lock));
+      ASSERT (run[i]->valid && run[i]->dirty);
+      ASSERT (run[i]->sector == run[0]->sector + i);
+      buffers[i] = run[i]->data;
+    }
+  block_write_multi (fs_device, run[0]->sector, cnt, buffers);
+  for (i = 0; i < cnt; i++)
+    run[i]->dirty = false;
+  write_back_cnt += cnt;
+}
+
+/* Write-behind thread.  Writes dirty sectors back every
+   FLUSH_TICKS timer ticks. */
+static void
+write_behind (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (FLUSH_TICKS);
+      cache_flush ();
+    }
+}
+
+/* Read-ahead thread.  Reads in the runs of sectors queued by
+   cache_read_ahead(). */
+static void
+read_ahead (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct read_ahead_run r;
+
+      lock_acquire (&cache_lock);
+      while (read_ahead_cnt == 0)
+        cond_wait (&read_ahead_ready, &cache_lock);
+      r = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_MAX;
+      read_ahead_cnt--;
+      lock_release (&cache_lock);
+
+      prefetch (r.sector, r.cnt, true);
+    }
+}
@@ -2,17 +2,15 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "devices/input.h"
 
-/* Serialize all process file system operations since they are 
-   not thread safe. */
-static struct lock filesys_lock;
-
 /* Partition that contains the file system. */
 struct block *fs_device;
 
@@ -23,12 +21,13 @@ static void do_format (void);
 void
 filesys_init (bool format) 
 {
-  lock_init (&filesys_lock);
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  file_init ();
   free_map_init ();
 
   if (format) 
@@ -43,6 +42,11 @@ void
 filesys_done (void) 
 {
   free_map_close ();
+
+  /* Writing back needs disk interrupts, which are off after a
+     kernel panic; the disk is not trustworthy then anyway. */
+  if (intr_get_level () == INTR_ON)
+    cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -113,29 +117,21 @@ allocate_fd(struct file *file)
 }
 
 
-/* The following functions provide a file descriptor wrapper around  the file system functionality.*/
+/* The following functions provide a file descriptor wrapper around  the file system functionality.
+   The file system does its own locking: each inode has a
+   readers-writer lock for its data and length, and each directory,
+   the free map and the list of open inodes have a lock of their
+   own, so operations on different files run in parallel. */
 bool
 process_file_create (const char *name, off_t initial_size)
 {
-  bool success;
-  
-  lock_acquire (&filesys_lock);
-  success = filesys_create (name, initial_size);
-  lock_release (&filesys_lock);
-  
-  return success;
+  return filesys_create (name, initial_size);
 }
 
 bool
 process_file_remove (const char *name)
 {
-  bool success;
-  
-  lock_acquire (&filesys_lock);
-  success = filesys_remove (name);
-  lock_release (&filesys_lock);
-  
-  return success;
+  return filesys_remove (name);
 }
 
 int
@@ -144,21 +140,15 @@ process_file_open (const char *name, bool deny_write)
   struct file *file;
   int fd = -1;
   
-  lock_acquire (&filesys_lock);
   file = filesys_open (name);
   if (file != NULL && deny_write)
     file_deny_write (file);
-  lock_release (&filesys_lock);
 
   if (file != NULL)
     {
       fd = allocate_fd (file);
       if (fd == -1)
-        {
-          lock_acquire (&filesys_lock);
-          file_close (file);
-          lock_release (&filesys_lock);
-        }
+        file_close (file);
     }
   
   return fd;
@@ -172,11 +162,7 @@ process_file_size (int fd)
 
   file = process_file_get_file (fd);
   if (file != NULL)
-    {
-      lock_acquire (&filesys_lock);
-      size = file_length (file);
-      lock_release (&filesys_lock);
-    }
+    size = file_length (file);
   
   return size;
 }
@@ -196,11 +182,8 @@ off_t process_file_read(int fd, void *buf_, off_t size)
     }
   } else {
     f = process_file_get_file(fd);
-    if (f != NULL) {
-      lock_acquire(&filesys_lock);
+    if (f != NULL)
       read_bytes = file_read(f, buf, size);
-      lock_release(&filesys_lock);
-    }
   }
 
   return read_bytes;
@@ -217,11 +200,8 @@ off_t process_file_write(int fd, const void *buf, off_t size)
     written = size;
   } else {
     f = process_file_get_file(fd);
-    if (f != NULL) {
-      lock_acquire(&filesys_lock);
+    if (f != NULL)
       written = file_write(f, buf, size);
-      lock_release(&filesys_lock);
-    }
   }
 
   return written;
@@ -230,11 +210,7 @@ off_t process_file_write(int fd, const void *buf, off_t size)
 
 off_t process_file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 {
-  off_t bytes_read;
-  lock_acquire (&filesys_lock);
-  bytes_read = file_read_at (file, buffer, size, file_ofs);
-  lock_release (&filesys_lock);
-  return bytes_read;
+  return file_read_at (file, buffer, size, file_ofs);
 }
 
 
@@ -242,13 +218,7 @@ off_t process_file_read_at (struct file *file, void *buffer, off_t size, off_t f
 off_t process_file_write_at (struct file *file, const void *buffer, off_t size,
                        off_t file_ofs)
 {
-  off_t bytes_written;
-  
-  lock_acquire (&filesys_lock);
-  bytes_written = file_write_at (file, buffer, size, file_ofs);
-  lock_release (&filesys_lock);
-  
-  return bytes_written;
+  return file_write_at (file, buffer, size, file_ofs);
 }
 
 void
@@ -258,11 +228,7 @@ process_file_seek (int fd, off_t new_pos)
 
   file = process_file_get_file (fd);
   if (file != NULL)
-    {
-      lock_acquire (&filesys_lock);
-      file_seek (file, new_pos);
-      lock_release (&filesys_lock);
-    }
+    file_seek (file, new_pos);
 }
 
 off_t
@@ -273,11 +239,7 @@ process_file_tell (int fd)
 
   file = process_file_get_file (fd);
   if (file != NULL)
-    {
-      lock_acquire (&filesys_lock);
-      pos = file_tell (file);
-      lock_release (&filesys_lock);
-    }
+    pos = file_tell (file);
   
   return pos;
 }
@@ -291,14 +253,33 @@ process_file_close (int fd)
   file = process_file_get_file (fd);
   if (file != NULL)
     {
-      lock_acquire (&filesys_lock);
       file_allow_write (file);
       file_close (file);
-      lock_release (&filesys_lock);
       cur->ofiles[fd] = NULL;
     }
 }
 
+/* Opens in the current process a copy of each file in OFILES, the
+   open file table of its parent, under the same descriptor.
+   Returns false if a file could not be opened; the copies opened
+   so far stay open. */
+bool
+process_file_inherit (struct file **ofiles)
+{
+  struct thread *cur = thread_current ();
+  bool success = true;
+  int fd;
+
+  for (fd = 2; fd < MAX_OPEN_FILES && success; fd++)
+    if (ofiles[fd] != NULL)
+      {
+        cur->ofiles[fd] = file_duplicate (ofiles[fd]);
+        success = cur->ofiles[fd] != NULL;
+      }
+
+  return success;
+}
+
 struct file *
 process_file_get_file (int fd)
 {
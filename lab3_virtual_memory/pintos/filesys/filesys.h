@@ -32,6 +32,7 @@ off_t process_file_write_at (struct file *file, const void *buffer, off_t size,
 void process_file_seek (int fd, off_t new_pos);
 off_t process_file_tell (int fd);
 void process_file_close (int fd);
+bool process_file_inherit (struct file **ofiles);
 bool process_file_is_file (int fd);
 struct file *process_file_get_file (int fd);
 #endif /* filesys/filesys.h */
\ No newline at end of file
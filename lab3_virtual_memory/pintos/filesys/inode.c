@@ -3,21 +3,43 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/slab.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of direct sector pointers in an on-disk inode. */
+#define DIRECT_CNT 124
+
+/* Number of sector pointers in an index block. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Most data sectors an inode can have. */
+#define MAX_SECTORS (DIRECT_CNT + PTRS_PER_SECTOR \
+                     + PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   The first DIRECT_CNT data sectors are listed in DIRECT, the
+   next PTRS_PER_SECTOR in the index block INDIRECT, and the rest
+   in the index blocks listed in the index block DOUBLY_INDIRECT.
+   A pointer of 0 means that no sector has been allocated, which
+   is unambiguous because sector 0 holds the free map's inode.
+   All data sectors up to LENGTH are allocated, when the file is
+   created or when a write extends it. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+    block_sector_t indirect;            /* Indirect index block. */
+    block_sector_t doubly_indirect;     /* Doubly indirect index block. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,7 +50,16 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* In-memory inode.
+
+   ELEM, OPEN_CNT and REMOVED are protected by OPEN_INODES_LOCK.
+   DATA and DENY_WRITE_CNT are protected by RW: reads, and writes
+   within the file, hold it for reading, so that they run in
+   parallel, and writes that extend the file hold it for writing.
+   Writes to the same sector are serialized by the buffer cache.
+   The first opener holds RW for writing until DATA is read in.
+   DIR_LOCK is not used by this module; it serializes the entries
+   of a directory stored in the inode. */
 struct inode 
   {
     struct list_elem elem;              /* Element in inode list. */
@@ -36,9 +67,26 @@ struct inode
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rw_lock rw;                  /* Protects data and length. */
+    struct lock dir_lock;               /* Directory entry lock. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* A sector of zeros, for new sectors. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+static block_sector_t get_sector (const struct inode_disk *, size_t idx);
+static size_t contiguous_sectors (const struct inode *, off_t pos,
+                                  size_t cnt);
+static bool set_sector (struct inode_disk *, size_t idx,
+                        block_sector_t sector);
+static bool extend (struct inode_disk *, off_t length);
+static void deallocate (struct inode_disk *);
+static block_sector_t read_ptr (block_sector_t sector, size_t idx);
+static void write_ptr (block_sector_t sector, size_t idx,
+                       block_sector_t ptr);
+static bool allocate_zeroed (block_sector_t *);
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
@@ -48,20 +96,43 @@ byte_to_sector (const struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
   if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+    return get_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
   else
     return -1;
 }
 
+/* Returns how many of the data sectors of INODE from the one that
+   contains byte offset POS, at most CNT of them, are also
+   consecutive on disk.  POS must be within INODE. */
+static size_t
+contiguous_sectors (const struct inode *inode, off_t pos, size_t cnt)
+{
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  size_t end = DIV_ROUND_UP (inode->data.length, BLOCK_SECTOR_SIZE);
+  block_sector_t first = get_sector (&inode->data, idx);
+  size_t n;
+
+  for (n = 1; n < cnt && idx + n < end; n++)
+    if (get_sector (&inode->data, idx + n) != first + n)
+      break;
+  return n;
+}
+
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
 static struct list open_inodes;
+static struct lock open_inodes_lock;
+
+/* Cache of in-memory inodes. */
+static struct slab_cache inode_cache;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
   list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
+  slab_cache_init (&inode_cache, "inode", sizeof (struct inode), NULL, 0);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -84,22 +155,14 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (extend (disk_inode, length)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_write (sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
         } 
+      else
+        deallocate (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -114,6 +177,8 @@ inode_open (block_sector_t sector)
   struct list_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
   for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
        e = list_next (e)) 
@@ -121,23 +186,41 @@ inode_open (block_sector_t sector)
       inode = list_entry (e, struct inode, elem);
       if (inode->sector == sector) 
         {
-          inode_reopen (inode);
+          inode->open_cnt++;
+          lock_release (&open_inodes_lock);
+
+          /* Wait until the thread that opened it first has read
+             in DATA. */
+          rw_lock_acquire_read (&inode->rw);
+          rw_lock_release_read (&inode->rw);
           return inode; 
         }
     }
 
   /* Allocate memory. */
-  inode = malloc (sizeof *inode);
+  inode = slab_alloc (&inode_cache);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
+  /* Initialize.  RW is held for writing until DATA is read in,
+     which is done without OPEN_INODES_LOCK, so that only other
+     threads opening the same sector wait for the disk.  No one
+     else can hold RW yet. */
   list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  rw_lock_init (&inode->rw);
+  lock_init (&inode->dir_lock);
+  rw_lock_acquire_write (&inode->rw);
+  lock_release (&open_inodes_lock);
+
+  cache_read (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  rw_lock_release_write (&inode->rw);
   return inode;
 }
 
@@ -146,7 +229,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -163,25 +250,30 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    list_remove (&inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Release resources if this was the last opener.  No one else
+     can find INODE any more. */
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          deallocate (&inode->data);
         }
 
-      free (inode); 
+      slab_free (&inode_cache, inode); 
     }
 }
 
@@ -191,7 +283,24 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
+  lock_release (&open_inodes_lock);
+}
+
+/* Acquires INODE's directory lock, which serializes lookups and
+   changes of the directory entries INODE holds. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,8 +311,10 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t fetched = offset;
+  block_sector_t next_sector;
 
+  rw_lock_acquire_read (&inode->rw);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -220,50 +331,79 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
+      /* Read the sectors that this read still wants into the
+         cache in runs that are consecutive on disk, one request
+         per run, rather than one sector at a time. */
+      if (offset >= fetched)
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          off_t want = size < inode_left ? size : inode_left;
+          size_t cnt = DIV_ROUND_UP (sector_ofs + want, BLOCK_SECTOR_SIZE);
+
+          cnt = contiguous_sectors (inode, offset, (cnt < CACHE_RUN_SECTORS
+                                                    ? cnt
+                                                    : CACHE_RUN_SECTORS));
+          if (cnt > 1)
+            cache_prefetch (sector_idx, cnt);
+          fetched = offset - sector_ofs + cnt * BLOCK_SECTOR_SIZE;
         }
+
+      cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  /* Start reading the sectors the next sequential read will
+     want. */
+  if (bytes_read > 0)
+    {
+      off_t next = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+
+      next_sector = byte_to_sector (inode, next);
+      if (next_sector != (block_sector_t) -1)
+        cache_read_ahead (next_sector,
+                          contiguous_sectors (inode, next,
+                                              CACHE_RUN_SECTORS));
+    }
+  rw_lock_release_read (&inode->rw);
 
   return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past end of file extends INODE, filling any gap with
+   zeros.  Returns the number of bytes actually written, which
+   may be less than SIZE if the disk is full or an error
+   occurs. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool extending;
+
+  /* Files only grow, so a write that fits in the file when we
+     look here still fits once we hold the lock. */
+  extending = size > 0 && offset + size > inode_length (inode);
+  if (extending)
+    rw_lock_acquire_write (&inode->rw);
+  else
+    rw_lock_acquire_read (&inode->rw);
 
   if (inode->deny_write_cnt)
-    return 0;
+    size = 0;
+
+  /* If the file cannot be extended, write what fits.  Index
+     blocks may have been added either way. */
+  if (size > 0 && offset + size > inode->data.length)
+    {
+      ASSERT (extending);
+      extend (&inode->data, offset + size);
+      cache_write (inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+    }
 
   while (size > 0) 
     {
@@ -281,39 +421,21 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The cache reads in the rest of the sector first if the
+         chunk does not cover all of it. */
+      cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+  if (extending)
+    rw_lock_release_write (&inode->rw);
+  else
+    rw_lock_release_read (&inode->rw);
   return bytes_written;
 }
 
@@ -322,8 +444,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rw_lock_acquire_write (&inode->rw);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rw_lock_release_write (&inode->rw);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +456,11 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rw_lock_acquire_write (&inode->rw);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rw_lock_release_write (&inode->rw);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
@@ -342,4 +468,170 @@ off_t
 inode_length (const struct inode *inode)
 {
   return inode->data.length;
-}
\ No newline at end of file
+}
+
+/* Returns entry IDX of index block SECTOR. */
+static block_sector_t
+read_ptr (block_sector_t sector, size_t idx)
+{
+  block_sector_t ptr;
+
+  cache_read (sector, &ptr, idx * sizeof ptr, sizeof ptr);
+  return ptr;
+}
+
+/* Sets entry IDX of index block SECTOR to PTR. */
+static void
+write_ptr (block_sector_t sector, size_t idx, block_sector_t ptr)
+{
+  cache_write (sector, &ptr, idx * sizeof ptr, sizeof ptr);
+}
+
+/* Allocates a sector, fills it with zeros, and stores it in
+   *SECTORP.  Returns false if the disk is full. */
+static bool
+allocate_zeroed (block_sector_t *sectorp)
+{
+  if (!free_map_allocate (1, sectorp))
+    return false;
+  cache_write (*sectorp, zeros, 0, BLOCK_SECTOR_SIZE);
+  return true;
+}
+
+/* Returns the sector that holds data sector IDX of DISK, or 0 if
+   none is allocated. */
+static block_sector_t
+get_sector (const struct inode_disk *disk, size_t idx)
+{
+  block_sector_t block;
+
+  if (idx < DIRECT_CNT)
+    return disk->direct[idx];
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    return disk->indirect != 0 ? read_ptr (disk->indirect, idx) : 0;
+  idx -= PTRS_PER_SECTOR;
+
+  if (disk->doubly_indirect == 0)
+    return 0;
+  block = read_ptr (disk->doubly_indirect, idx / PTRS_PER_SECTOR);
+  return block != 0 ? read_ptr (block, idx % PTRS_PER_SECTOR) : 0;
+}
+
+/* Makes SECTOR data sector IDX of DISK, allocating the index
+   blocks that lead to it if need be.  Returns false if one could
+   not be allocated.  Does not write DISK itself to disk. */
+static bool
+set_sector (struct inode_disk *disk, size_t idx, block_sector_t sector)
+{
+  block_sector_t block;
+
+  ASSERT (idx < MAX_SECTORS);
+  if (idx < DIRECT_CNT)
+    {
+      disk->direct[idx] = sector;
+      return true;
+    }
+  idx -= DIRECT_CNT;
+
+  if (idx < PTRS_PER_SECTOR)
+    {
+      if (disk->indirect == 0 && !allocate_zeroed (&disk->indirect))
+        return false;
+      write_ptr (disk->indirect, idx, sector);
+      return true;
+    }
+  idx -= PTRS_PER_SECTOR;
+
+  if (disk->doubly_indirect == 0
+      && !allocate_zeroed (&disk->doubly_indirect))
+    return false;
+  block = read_ptr (disk->doubly_indirect, idx / PTRS_PER_SECTOR);
+  if (block == 0)
+    {
+      if (!allocate_zeroed (&block))
+        return false;
+      write_ptr (disk->doubly_indirect, idx / PTRS_PER_SECTOR, block);
+    }
+  write_ptr (block, idx % PTRS_PER_SECTOR, sector);
+  return true;
+}
+
+/* Extends DISK, which must be no longer than LENGTH, to LENGTH
+   bytes, allocating zeroed data sectors for it.  The new sectors
+   are taken in one contiguous run if there is one, so that a file
+   written sequentially stays contiguous on disk.  Returns true if
+   successful.  Returns false, and leaves DISK's length and data
+   sectors as they were, if the disk is full or LENGTH is too
+   large; index blocks allocated meanwhile stay in DISK. */
+static bool
+extend (struct inode_disk *disk, off_t length)
+{
+  size_t old_cnt = bytes_to_sectors (disk->length);
+  size_t new_cnt = bytes_to_sectors (length);
+  block_sector_t run = 0;
+  bool in_run;
+  size_t i;
+
+  ASSERT (length >= disk->length);
+  if (new_cnt > MAX_SECTORS)
+    return false;
+
+  in_run = new_cnt > old_cnt && free_map_allocate (new_cnt - old_cnt, &run);
+  for (i = old_cnt; i < new_cnt; i++)
+    {
+      block_sector_t sector = run + (i - old_cnt);
+
+      if (!in_run && !free_map_allocate (1, &sector))
+        break;
+      if (!set_sector (disk, i, sector))
+        {
+          if (!in_run)
+            free_map_release (sector, 1);
+          break;
+        }
+      cache_write (sector, zeros, 0, BLOCK_SECTOR_SIZE);
+    }
+
+  if (i < new_cnt)
+    {
+      /* Give back the new sectors.  Their index blocks exist, so
+         clearing their pointers cannot fail. */
+      if (in_run)
+        free_map_release (run + (i - old_cnt), new_cnt - i);
+      while (i-- > old_cnt)
+        {
+          free_map_release (get_sector (disk, i), 1);
+          set_sector (disk, i, 0);
+        }
+      return false;
+    }
+
+  disk->length = length;
+  return true;
+}
+
+/* Releases DISK's data sectors and index blocks. */
+static void
+deallocate (struct inode_disk *disk)
+{
+  size_t sector_cnt = bytes_to_sectors (disk->length);
+  size_t i;
+
+  for (i = 0; i < sector_cnt; i++)
+    free_map_release (get_sector (disk, i), 1);
+
+  if (disk->indirect != 0)
+    free_map_release (disk->indirect, 1);
+  if (disk->doubly_indirect != 0)
+    {
+      for (i = 0; i < PTRS_PER_SECTOR; i++)
+        {
+          block_sector_t block = read_ptr (disk->doubly_indirect, i);
+          if (block != 0)
+            free_map_release (block, 1);
+        }
+      free_map_release (disk->doubly_indirect, 1);
+    }
+}
@@ -3,6 +3,7 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,11 +24,24 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Above the bits sit two summary levels, with one bit per
+   element of BITS: FULL tells which elements have all their bits
+   set and EMPTY which have none set.  Scans work an element at a
+   time and use the summaries to skip over whole runs of elements
+   that cannot hold what they look for, ELEM_BITS elements per
+   summary element.  The summaries are kept up to date by every
+   function that changes bits, so changes to a bitmap must be
+   serialized by its user; each bit itself is still set
+   atomically. */
 struct bitmap
   {
     size_t bit_cnt;     /* Number of bits. */
     elem_type *bits;    /* Elements that represent bits. */
+    elem_type *full;    /* Summary of elements with all bits set. */
+    elem_type *empty;   /* Summary of elements with no bits set. */
+    size_t hint;        /* Where bitmap_scan_and_flip_next() starts. */
   };
 
 /* Returns the index of the element that contains the bit
@@ -60,6 +74,14 @@ byte_cnt (size_t bit_cnt)
   return sizeof (elem_type) * elem_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required for BIT_CNT bits and their
+   summaries. */
+static inline size_t
+total_byte_cnt (size_t bit_cnt)
+{
+  return byte_cnt (bit_cnt) + 2 * byte_cnt (elem_cnt (bit_cnt));
+}
+
 /* Returns a bit mask in which the bits actually used in the last
    element of B's bits are set to 1 and the rest are set to 0. */
 static inline elem_type
@@ -68,6 +90,100 @@ last_mask (const struct bitmap *b)
   int last_bits = b->bit_cnt % ELEM_BITS;
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns a bit mask in which bits FROM through TO - 1 of an
+   element are set to 1 and the rest are set to 0, where
+   0 <= FROM < TO <= ELEM_BITS. */
+static inline elem_type
+range_mask (size_t from, size_t to)
+{
+  elem_type high = to < ELEM_BITS ? ((elem_type) 1 << to) - 1 : (elem_type) -1;
+  return high & ~(((elem_type) 1 << from) - 1);
+}
+
+/* Returns the number of bits set in E.  The kernel is not linked
+   with libgcc, which provides __builtin_popcount(), so this adds
+   up the bits in parallel within ever wider fields instead. */
+static inline size_t
+pop_count (elem_type e)
+{
+  const elem_type ones = (elem_type) -1;
+
+  e -= (e >> 1) & (ones / 3);
+  e = (e & (ones / 15 * 3)) + ((e >> 2) & (ones / 15 * 3));
+  e = (e + (e >> 4)) & (ones / 255 * 15);
+  return (e * (ones / 255)) >> (ELEM_BITS - CHAR_BIT);
+}
+
+/* Returns the index of the lowest set bit in E, which must not be
+   zero.  This compiles to a single BSF instruction. */
+static inline size_t
+first_set (elem_type e)
+{
+  return __builtin_ctzl (e);
+}
+
+/* Sets the bits of MASK in *E.
+
+   This is equivalent to `*e |= mask' except that it is
+   guaranteed to be atomic on a uniprocessor machine.  See the
+   description of the OR instruction in [IA32-v2b]. */
+static inline void
+set_bits (elem_type *e, elem_type mask)
+{
+  asm ("orl %1, %0" : "+m" (*e) : "r" (mask) : "cc");
+}
+
+/* Clears the bits of MASK in *E.
+
+   This is equivalent to `*e &= ~mask' except that it is
+   guaranteed to be atomic on a uniprocessor machine.  See the
+   description of the AND instruction in [IA32-v2a]. */
+static inline void
+clear_bits (elem_type *e, elem_type mask)
+{
+  asm ("andl %1, %0" : "+m" (*e) : "r" (~mask) : "cc");
+}
+
+/* Brings the summary bits for element IDX of B up to date.
+   Summary elements cover bits that different users of B may
+   change under different locks, so they are changed
+   atomically. */
+static inline void
+update_summary (struct bitmap *b, size_t idx)
+{
+  elem_type all = (idx == elem_cnt (b->bit_cnt) - 1
+                   ? last_mask (b) : (elem_type) -1);
+  elem_type e = b->bits[idx];
+  elem_type mask = bit_mask (idx);
+
+  if (e == all)
+    set_bits (&b->full[elem_idx (idx)], mask);
+  else
+    clear_bits (&b->full[elem_idx (idx)], mask);
+  if (e == 0)
+    set_bits (&b->empty[elem_idx (idx)], mask);
+  else
+    clear_bits (&b->empty[elem_idx (idx)], mask);
+}
+
+/* Returns the index of the first element at or after element IDX
+   whose bit is clear in SUMMARY, or a value of at least LIMIT
+   if there is none. */
+static inline size_t
+next_clear (const elem_type *summary, size_t idx, size_t limit)
+{
+  size_t s = elem_idx (idx);
+  elem_type e = ~summary[s] & ~(bit_mask (idx) - 1);
+
+  while (e == 0)
+    {
+      if (++s * ELEM_BITS >= limit)
+        return limit;
+      e = ~summary[s];
+    }
+  return s * ELEM_BITS + first_set (e);
+}
 
 /* Creation and destruction. */
 
@@ -82,9 +198,12 @@ bitmap_create (size_t bit_cnt)
   if (b != NULL)
     {
       b->bit_cnt = bit_cnt;
-      b->bits = malloc (byte_cnt (bit_cnt));
+      b->bits = malloc (total_byte_cnt (bit_cnt));
       if (b->bits != NULL || bit_cnt == 0)
         {
+          b->full = b->bits + elem_cnt (bit_cnt);
+          b->empty = b->full + elem_cnt (elem_cnt (bit_cnt));
+          b->hint = 0;
           bitmap_set_all (b, false);
           return b;
         }
@@ -105,6 +224,9 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 
   b->bit_cnt = bit_cnt;
   b->bits = (elem_type *) (b + 1);
+  b->full = b->bits + elem_cnt (bit_cnt);
+  b->empty = b->full + elem_cnt (elem_cnt (bit_cnt));
+  b->hint = 0;
   bitmap_set_all (b, false);
   return b;
 }
@@ -114,7 +236,7 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED)
 size_t
 bitmap_buf_size (size_t bit_cnt) 
 {
-  return sizeof (struct bitmap) + byte_cnt (bit_cnt);
+  return sizeof (struct bitmap) + total_byte_cnt (bit_cnt);
 }
 
 /* Destroys bitmap B, freeing its storage.
@@ -157,12 +279,9 @@ void
 bitmap_mark (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] |= mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the OR instruction in [IA32-v2b]. */
-  asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  set_bits (&b->bits[idx], bit_mask (bit_idx));
+  update_summary (b, idx);
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
@@ -170,12 +289,9 @@ void
 bitmap_reset (struct bitmap *b, size_t bit_idx) 
 {
   size_t idx = elem_idx (bit_idx);
-  elem_type mask = bit_mask (bit_idx);
 
-  /* This is equivalent to `b->bits[idx] &= ~mask' except that it
-     is guaranteed to be atomic on a uniprocessor machine.  See
-     the description of the AND instruction in [IA32-v2a]. */
-  asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+  clear_bits (&b->bits[idx], bit_mask (bit_idx));
+  update_summary (b, idx);
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -191,6 +307,7 @@ bitmap_flip (struct bitmap *b, size_t bit_idx)
      is guaranteed to be atomic on a uniprocessor machine.  See
      the description of the XOR instruction in [IA32-v2b]. */
   asm ("xorl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+  update_summary (b, idx);
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -210,6 +327,8 @@ bitmap_set_all (struct bitmap *b, bool value)
 {
   ASSERT (b != NULL);
 
+  memset (b->full, 0, byte_cnt (elem_cnt (b->bit_cnt)));
+  memset (b->empty, 0, byte_cnt (elem_cnt (b->bit_cnt)));
   bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
@@ -217,14 +336,26 @@ bitmap_set_all (struct bitmap *b, bool value)
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t i, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  end = start + cnt;
+  for (i = start; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = end - i < ELEM_BITS - ofs ? end - i : ELEM_BITS - ofs;
+      elem_type mask = range_mask (ofs, ofs + n);
+
+      if (value)
+        set_bits (&b->bits[elem_idx (i)], mask);
+      else
+        clear_bits (&b->bits[elem_idx (i)], mask);
+      update_summary (b, elem_idx (i));
+      i += n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -232,17 +363,23 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i, value_cnt;
+  size_t i, end, set_cnt;
 
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
-  return value_cnt;
+  end = start + cnt;
+  set_cnt = 0;
+  for (i = start; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = end - i < ELEM_BITS - ofs ? end - i : ELEM_BITS - ofs;
+
+      set_cnt += pop_count (b->bits[elem_idx (i)] & range_mask (ofs, ofs + n));
+      i += n;
+    }
+  return value ? set_cnt : cnt - set_cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -250,15 +387,23 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  size_t i, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  end = start + cnt;
+  for (i = start; i < end; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = end - i < ELEM_BITS - ofs ? end - i : ELEM_BITS - ofs;
+      elem_type e = b->bits[elem_idx (i)];
+
+      if ((value ? e : ~e) & range_mask (ofs, ofs + n))
+        return true;
+      i += n;
+    }
   return false;
 }
 
@@ -291,20 +436,86 @@ bitmap_all (const struct bitmap *b, size_t start, size_t cnt)
 /* Finds and returns the starting index of the first group of CNT
    consecutive bits in B at or after START that are all set to
    VALUE.
-   If there is no such group, returns BITMAP_ERROR. */
+   If there is no such group, returns BITMAP_ERROR.
+
+   The bitmap is scanned an element at a time.  Elements that hold
+   no bit set to VALUE are skipped using the summaries, and runs
+   within an element are found with BSF. */
 size_t
 bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
+  const elem_type *skip;
+  size_t run_start, run_len;
+  size_t i, last;
+
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
 
-  if (cnt <= b->bit_cnt) 
+  if (cnt == 0)
+    return start;
+  if (cnt > b->bit_cnt)
+    return BITMAP_ERROR;
+
+  skip = value ? b->empty : b->full;
+  last = elem_cnt (b->bit_cnt) - 1;
+  run_start = run_len = 0;
+  for (i = elem_idx (start); i <= last; i++)
     {
-      size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      elem_type e;
+      size_t bit;
+
+      if (run_len == 0 && (skip[elem_idx (i)] & bit_mask (i)))
+        {
+          /* Skip straight to the next element that may start a
+             run.  The loop increment moves past it, so step back
+             one. */
+          i = next_clear (skip, i, last + 1) - 1;
+          continue;
+        }
+
+      /* E has a 1 bit for each bit in this element set to VALUE
+         that lies inside [START, bit_cnt). */
+      e = value ? b->bits[i] : ~b->bits[i];
+      if (i == elem_idx (start))
+        e &= ~(bit_mask (start) - 1);
+      if (i == last)
+        e &= last_mask (b);
+
+      if (e == (elem_type) -1)
+        {
+          /* The whole element extends the run. */
+          if (run_len == 0)
+            run_start = i * ELEM_BITS;
+          run_len += ELEM_BITS;
+        }
+      else
+        for (bit = 0; bit < ELEM_BITS; )
+          {
+            /* Extend the run by the 1 bits starting at BIT. */
+            elem_type rest = e >> bit;
+            size_t ones = first_set (~rest);
+
+            if (ones > 0)
+              {
+                if (run_len == 0)
+                  run_start = i * ELEM_BITS + bit;
+                run_len += ones;
+                if (run_len >= cnt)
+                  return run_start;
+                bit += ones;
+                rest = bit < ELEM_BITS ? e >> bit : 0;
+              }
+            if (bit >= ELEM_BITS)
+              break;
+
+            /* The run ends at a 0 bit.  Go to the next 1 bit. */
+            run_len = 0;
+            if (rest == 0)
+              break;
+            bit += first_set (rest);
+          }
+      if (run_len >= cnt)
+        return run_start;
     }
   return BITMAP_ERROR;
 }
@@ -324,6 +535,27 @@ bitmap_scan_and_flip (struct bitmap *b, size_t start, size_t cnt, bool value)
     bitmap_set_multiple (b, idx, cnt, !value);
   return idx;
 }
+
+/* Like bitmap_scan_and_flip(), but starts looking where the last
+   call to this function on B left off and wraps around to the
+   start of B if necessary, so that successive allocations are
+   placed one after another instead of each starting over at bit
+   0. */
+size_t
+bitmap_scan_and_flip_next (struct bitmap *b, size_t cnt, bool value)
+{
+  size_t start = b->hint <= b->bit_cnt ? b->hint : 0;
+  size_t idx = bitmap_scan (b, start, cnt, value);
+
+  if (idx == BITMAP_ERROR && start > 0)
+    idx = bitmap_scan (b, 0, cnt, value);
+  if (idx != BITMAP_ERROR)
+    {
+      bitmap_set_multiple (b, idx, cnt, !value);
+      b->hint = idx + cnt;
+    }
+  return idx;
+}
 
 /* File input and output. */
 
@@ -344,8 +576,12 @@ bitmap_read (struct bitmap *b, struct file *file)
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
+      size_t i;
+
       success = file_read_at (file, b->bits, size, 0) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+      for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+        update_summary (b, i);
     }
   return success;
 }
@@ -0,0 +1,195 @@
+#include "lz.h"
+#include <debug.h>
+#include <string.h>
+
+static uint32_t read32 (const uint8_t *);
+static unsigned hash32 (uint32_t);
+static uint8_t *put_length (uint8_t *op, uint8_t *oend, size_t len);
+static uint8_t *put_sequence (uint8_t *op, uint8_t *oend,
+                              const uint8_t *lit, size_t lit_len,
+                              size_t offset, size_t match_len);
+static const uint8_t *get_length (const uint8_t *ip, const uint8_t *iend,
+                                  size_t *len);
+
+/* Compresses the SRC_SIZE bytes at SRC into the DST_SIZE bytes at
+   DST, using TABLE as scratch space.  Returns the compressed size,
+   or 0 if it would be larger than DST_SIZE. */
+size_t
+lz_compress (const void *src_, size_t src_size,
+             void *dst_, size_t dst_size, lz_table table)
+{
+  const uint8_t *src = src_;
+  const uint8_t *end = src + src_size;
+  const uint8_t *ip = src;
+  const uint8_t *anchor = src;
+  const uint8_t *ref;
+  uint8_t *op = dst_;
+  uint8_t *oend = op + dst_size;
+  size_t match_len;
+  unsigned h, pos;
+
+  ASSERT (src_size <= LZ_MAX_INPUT);
+
+  /* Table entries are positions plus 1, so that 0 means none. */
+  memset (table, 0, sizeof (lz_table));
+  while (end - ip >= LZ_MIN_MATCH)
+    {
+      h = hash32 (read32 (ip));
+      pos = table[h];
+      table[h] = ip - src + 1;
+      if (pos == 0 || read32 (src + pos - 1) != read32 (ip))
+        {
+          ip++;
+          continue;
+        }
+      ref = src + pos - 1;
+
+      match_len = LZ_MIN_MATCH;
+      while (ip + match_len < end && ref[match_len] == ip[match_len])
+        match_len++;
+      op = put_sequence (op, oend, anchor, ip - anchor, ip - ref, match_len);
+      if (op == NULL)
+        return 0;
+      ip += match_len;
+      anchor = ip;
+    }
+
+  op = put_sequence (op, oend, anchor, end - anchor, 0, 0);
+  return op != NULL ? op - (uint8_t *) dst_ : 0;
+}
+
+/* Decompresses the SRC_SIZE bytes at SRC, which must have been
+   produced by lz_compress(), into the DST_SIZE bytes at DST.
+   Returns true if the data decompressed to exactly DST_SIZE
+   bytes, false if it is corrupt. */
+bool
+lz_decompress (const void *src_, size_t src_size, void *dst_, size_t dst_size)
+{
+  const uint8_t *ip = src_;
+  const uint8_t *iend = ip + src_size;
+  uint8_t *dst = dst_;
+  uint8_t *op = dst;
+  uint8_t *oend = dst + dst_size;
+  size_t lit_len, match_len, offset;
+  uint8_t token;
+
+  for (;;)
+    {
+      if (ip >= iend)
+        return false;
+      token = *ip++;
+
+      lit_len = token >> 4;
+      if (lit_len == 15 && (ip = get_length (ip, iend, &lit_len)) == NULL)
+        return false;
+      if ((size_t) (iend - ip) < lit_len || (size_t) (oend - op) < lit_len)
+        return false;
+      memcpy (op, ip, lit_len);
+      op += lit_len;
+      ip += lit_len;
+      if (ip == iend)
+        return op == oend;
+
+      if (iend - ip < 2)
+        return false;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      match_len = token & 15;
+      if (match_len == 15 && (ip = get_length (ip, iend, &match_len)) == NULL)
+        return false;
+      match_len += LZ_MIN_MATCH;
+      if (offset == 0 || offset > (size_t) (op - dst)
+          || (size_t) (oend - op) < match_len)
+        return false;
+
+      /* The match may overlap the bytes it produces. */
+      for (; match_len > 0; match_len--, op++)
+        *op = op[-offset];
+    }
+}
+
+/* Returns the possibly unaligned 32-bit word at P. */
+static uint32_t
+read32 (const uint8_t *p)
+{
+  uint32_t v;
+  memcpy (&v, p, sizeof v);
+  return v;
+}
+
+/* Returns a hash table index for the 4 bytes in V. */
+static unsigned
+hash32 (uint32_t v)
+{
+  return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes the extension bytes for a nibble length of 15 + LEN at
+   OP.  Returns the new output position, or a null pointer if they
+   do not fit before OEND. */
+static uint8_t *
+put_length (uint8_t *op, uint8_t *oend, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    {
+      if (op >= oend)
+        return NULL;
+      *op++ = 255;
+    }
+  if (op >= oend)
+    return NULL;
+  *op++ = len;
+  return op;
+}
+
+/* Writes a sequence at OP with the LIT_LEN literal bytes at LIT and
+   a match of MATCH_LEN bytes OFFSET bytes back, or no match if
+   MATCH_LEN is 0.  Returns the new output position, or a null
+   pointer if the sequence does not fit before OEND. */
+static uint8_t *
+put_sequence (uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t lit_len,
+              size_t offset, size_t match_len)
+{
+  uint8_t *token;
+
+  if (op >= oend)
+    return NULL;
+  token = op++;
+  *token = (lit_len < 15 ? lit_len : 15) << 4;
+  if (lit_len >= 15 && (op = put_length (op, oend, lit_len - 15)) == NULL)
+    return NULL;
+  if ((size_t) (oend - op) < lit_len)
+    return NULL;
+  memcpy (op, lit, lit_len);
+  op += lit_len;
+  if (match_len == 0)
+    return op;
+
+  if (oend - op < 2)
+    return NULL;
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+  match_len -= LZ_MIN_MATCH;
+  *token |= match_len < 15 ? match_len : 15;
+  if (match_len >= 15 && (op = put_length (op, oend, match_len - 15)) == NULL)
+    return NULL;
+  return op;
+}
+
+/* Adds the length extension bytes at IP to *LEN.  Returns the
+   position after them, or a null pointer if they run past IEND. */
+static const uint8_t *
+get_length (const uint8_t *ip, const uint8_t *iend, size_t *len)
+{
+  uint8_t b;
+
+  do
+    {
+      if (ip >= iend)
+        return NULL;
+      b = *ip++;
+      *len += b;
+    }
+  while (b == 255);
+  return ip;
+}
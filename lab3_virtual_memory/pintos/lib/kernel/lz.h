@@ -0,0 +1,35 @@
+#ifndef __LIB_KERNEL_LZ_H
+#define __LIB_KERNEL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Fast LZ77 compression.
+
+   The compressed data is a series of sequences, each a token byte
+   followed by a run of literal bytes and a back reference to a
+   match of at least LZ_MIN_MATCH bytes.  The high nibble of the
+   token holds the literal count and the low nibble the match
+   length minus LZ_MIN_MATCH; a nibble of 15 is extended by bytes
+   that are added to it, up to and including the first byte that is
+   not 255.  A back reference is a 2-byte little-endian offset,
+   followed by any match length extension bytes.  The last sequence
+   has literals only.
+
+   Matches are found through a hash table of recent positions, so
+   inputs are limited to 64 kB.  The caller provides the table,
+   which need not be initialized. */
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_INPUT 65535
+
+typedef uint16_t lz_table[1 << LZ_HASH_BITS];
+
+size_t lz_compress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size, lz_table table);
+bool lz_decompress (const void *src, size_t src_size,
+                    void *dst, size_t dst_size);
+
+#endif /* lib/kernel/lz.h */
@@ -1,5 +1,21 @@
 #include <string.h>
 #include <debug.h>
+#include <stdint.h>
+
+/* memcpy(), memmove() and memset() move whole 32-bit words with
+   the x86 string instructions REP MOVSL and REP STOSL, which are
+   several times faster than a byte-at-a-time loop.  A few bytes
+   are handled one at a time first, to align the destination to a
+   word, and last, for the bytes past the last whole word.  Short
+   blocks are not worth the setup and are done bytewise.
+
+   The string instructions depend on the direction flag, which the
+   System V ABI guarantees is clear on function entry; the kernel's
+   interrupt entry code clears it as well. */
+
+/* Blocks shorter than this many bytes are moved a byte at a
+   time. */
+#define WORDWISE_MIN 16
 
 /* Copies SIZE bytes from SRC to DST, which must not overlap.
    Returns DST. */
@@ -12,6 +28,17 @@ memcpy (void *dst_, const void *src_, size_t size)
   ASSERT (dst != NULL || size == 0);
   ASSERT (src != NULL || size == 0);
 
+  if (size >= WORDWISE_MIN)
+    {
+      size_t words;
+
+      for (; (uintptr_t) dst % sizeof (uint32_t) != 0; size--)
+        *dst++ = *src++;
+      words = size / sizeof (uint32_t);
+      asm volatile ("rep movsl"
+                    : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+      size %= sizeof (uint32_t);
+    }
   while (size-- > 0)
     *dst++ = *src++;
 
@@ -31,18 +58,38 @@ memmove (void *dst_, const void *src_, size_t size)
 
   if (dst < src) 
     {
-      while (size-- > 0)
-        *dst++ = *src++;
+      /* Copying upward never overwrites a byte of SRC before it
+         has been read. */
+      memcpy (dst, src, size);
     }
   else 
     {
       dst += size;
       src += size;
+      if (size >= WORDWISE_MIN)
+        {
+          size_t words;
+
+          for (; (uintptr_t) dst % sizeof (uint32_t) != 0; size--)
+            *--dst = *--src;
+          words = size / sizeof (uint32_t);
+
+          /* Copy downward, starting from the last word.  The
+             direction flag is set only for the copy. */
+          dst -= sizeof (uint32_t);
+          src -= sizeof (uint32_t);
+          asm volatile ("std; rep movsl; cld"
+                        : "+D" (dst), "+S" (src), "+c" (words)
+                        : : "memory", "cc");
+          dst += sizeof (uint32_t);
+          src += sizeof (uint32_t);
+          size %= sizeof (uint32_t);
+        }
       while (size-- > 0)
         *--dst = *--src;
     }
 
-  return dst;
+  return dst_;
 }
 
 /* Find the first differing byte in the two blocks of SIZE bytes
@@ -281,7 +328,19 @@ memset (void *dst_, int value, size_t size)
   unsigned char *dst = dst_;
 
   ASSERT (dst != NULL || size == 0);
-  
+
+  if (size >= WORDWISE_MIN)
+    {
+      uint32_t word = (unsigned char) value * 0x01010101u;
+      size_t words;
+
+      for (; (uintptr_t) dst % sizeof (uint32_t) != 0; size--)
+        *dst++ = value;
+      words = size / sizeof (uint32_t);
+      asm volatile ("rep stosl"
+                    : "+D" (dst), "+c" (words) : "a" (word) : "memory");
+      size %= sizeof (uint32_t);
+    }
   while (size-- > 0)
     *dst++ = value;
 
@@ -0,0 +1,39 @@
+/* Tests that a file grows when it is written past its end.  The
+   file starts empty, gets a block at the front, and then a block
+   written after a seek well past the 124 direct sectors of an
+   inode.  The gap between them must read back as zeros. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HEAD_SIZE 1234
+#define TAIL_SIZE 4321
+
+static char buf[101234];
+
+void
+test_main (void) 
+{
+  const char *file_name = "testfile";
+  char *tail = buf + sizeof buf - TAIL_SIZE;
+  int fd;
+
+  random_bytes (buf, HEAD_SIZE);
+  random_bytes (tail, TAIL_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, HEAD_SIZE) == HEAD_SIZE,
+         "write %d bytes to \"%s\"", HEAD_SIZE, file_name);
+  CHECK (filesize (fd) == HEAD_SIZE, "filesize \"%s\"", file_name);
+  msg ("seek \"%s\"", file_name);
+  seek (fd, tail - buf);
+  CHECK (write (fd, tail, TAIL_SIZE) == TAIL_SIZE,
+         "write %d bytes to \"%s\"", TAIL_SIZE, file_name);
+  CHECK (filesize (fd) == (int) sizeof buf, "filesize \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  check_file (file_name, buf, sizeof buf);
+}
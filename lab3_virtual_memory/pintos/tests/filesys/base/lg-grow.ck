@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-grow) begin
+(lg-grow) create "testfile"
+(lg-grow) open "testfile"
+(lg-grow) write 1234 bytes to "testfile"
+(lg-grow) filesize "testfile"
+(lg-grow) seek "testfile"
+(lg-grow) write 4321 bytes to "testfile"
+(lg-grow) filesize "testfile"
+(lg-grow) close "testfile"
+(lg-grow) open "testfile" for verification
+(lg-grow) verified contents of "testfile"
+(lg-grow) close "testfile"
+(lg-grow) end
+EOF
+pass;
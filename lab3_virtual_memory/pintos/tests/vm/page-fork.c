@@ -0,0 +1,49 @@
+/* Forks a process that owns 1 MB of initialized memory.  The child
+   modifies its copy while the parent waits, after which the
+   parent verifies that its own copy is unchanged. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  pid_t child;
+  size_t i;
+
+  msg ("initialize");
+  memset (buf, 0x5a, sizeof buf);
+
+  child = fork ();
+  if (child == 0)
+    {
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != 0x5a)
+          fail ("child: byte %zu != 0x5a", i);
+      arc4_init (&arc4, "foobar", 6);
+      arc4_crypt (&arc4, buf, SIZE);
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != 0x5a)
+          break;
+      if (i == SIZE)
+        fail ("child: encryption had no effect");
+      msg ("child modified its copy");
+      exit (0x42);
+    }
+  if (child == PID_ERROR)
+    fail ("fork");
+  CHECK (wait (child) == 0x42, "wait for child");
+
+  msg ("read pass");
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu != 0x5a", i);
+}
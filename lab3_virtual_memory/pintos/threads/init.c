@@ -29,7 +29,9 @@
 #include "userprog/syscall.h"
 #include "userprog/tss.h"
 #include "vm/frame.h"
+#include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 #else
 #include "tests/threads/tests.h"
 #endif
@@ -40,6 +42,11 @@
 #include "filesys/fsutil.h"
 #endif
 
+/* CPUID function 1 EDX bits for 4 MB page support and global
+   page support. */
+#define CPUID_PSE 0x00000008
+#define CPUID_PGE 0x00002000
+
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
@@ -115,6 +122,7 @@ main (void)
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
+  pageinfo_init ();
   frametable_init ();
 #endif
 
@@ -132,6 +140,7 @@ main (void)
 
 #ifdef USERPROG
   swap_init ();
+  frametable_start_pageout ();
 #endif
 
   printf ("Boot complete.\n");
@@ -157,15 +166,50 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Returns the feature flags that CPUID function 1 reports in
+   EDX.  See [IA32-v2a] "CPUID--CPU Identification". */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
+}
+
+/* Returns true if the CPU supports 4 MB pages. */
+static bool
+cpu_has_pse (void)
+{
+  return (cpu_features () & CPUID_PSE) != 0;
+}
+
+/* Returns true if the CPU supports global pages. */
+static bool
+cpu_has_pge (void)
+{
+  return (cpu_features () & CPUID_PGE) != 0;
+}
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Where the CPU supports it, each aligned 4 MB of RAM is mapped
+   with a single 4 MB page instead of a page table, so that the
+   kernel's accesses to memory take fewer TLB entries.  The 4 MB
+   that hold the read-only kernel text, and RAM past the last
+   whole 4 MB, are still mapped with 4 kB pages.  Page
+   directories made by pagedir_create() copy these entries. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
+  uint32_t cr4, cr4_bits;
   size_t page;
+  bool pse = cpu_has_pse ();
+  uint32_t global = cpu_has_pge () ? PTE_G : 0;
   extern char _start, _end_kernel_text;
 
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
@@ -178,15 +222,37 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0 && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr) | global;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      /* Every page directory maps the kernel the same way, so
+         its entries can stay in the TLB when CR3 is reloaded, if
+         the CPU supports global pages. */
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | global;
     }
 
+  /* Turn on global pages, so that TLB entries for the kernel
+     mappings marked PTE_G survive CR3 loads, and 4 MB pages, if
+     the CPU supports them.  This must happen before the new page
+     directory is loaded.  See [IA32-v2a] "CPUID--CPU
+     Identification", [IA32-v3a] 2.5 "Control Registers" and 3.12
+     "Translation Lookaside Buffers (TLBs)". */
+  cr4_bits = (global ? CR4_PGE : 0) | (pse ? CR4_PSE : 0);
+  if (cr4_bits != 0)
+    asm volatile ("movl %%cr4, %0; orl %1, %0; movl %0, %%cr4"
+                  : "=&r" (cr4) : "r" (cr4_bits));
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
@@ -258,6 +324,21 @@ parse_options (char **argv)
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
 #endif
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-pageout-low"))
+        pageout_low_water = atoi (value);
+      else if (!strcmp (name, "-pageout-high"))
+        pageout_high_water = atoi (value);
+      else if (!strcmp (name, "-swap-ra"))
+        swap_read_ahead_pages = atoi (value);
+      else if (!strcmp (name, "-zswap"))
+        zswap_pool_pages = atoi (value);
+      else if (!strcmp (name, "-vm-policy"))
+        {
+          if (!frametable_set_policy (value))
+            PANIC ("unknown replacement policy `%s' (use -h for help)", value);
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -388,6 +469,14 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -pageout-low=COUNT Wake pageout below COUNT free frames.\n"
+          "  -pageout-high=COUNT Let pageout free up to COUNT frames.\n"
+          "  -swap-ra=COUNT     Read ahead up to COUNT pages on swap-in.\n"
+          "  -zswap=PAGES       Keep compressed swap pages in up to PAGES pages.\n"
+          "  -vm-policy=NAME    Use page replacement policy NAME: clock (default),\n"
+          "                     2q or car.\n"
 #endif
           );
   shutdown_power_off ();
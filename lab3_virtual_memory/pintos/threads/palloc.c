@@ -2,11 +2,13 @@
 #include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -21,24 +23,105 @@
    that the kernel needs to have memory for its own operations
    even if user processes are swapping like mad.
 
-   By default, half of system RAM is given to the kernel pool and
-   half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   Initially half of system RAM is given to the kernel pool and
+   half to the user pool.  The split is not fixed, though: memory
+   is owned by the pools in chunks of CHUNK_PAGES pages, and a
+   pool that runs out of free pages borrows a free chunk from the
+   other one.  The kernel pool never lends below a reserve of an
+   eighth of memory, so the kernel can always count on that much,
+   and the user pool never grows beyond the -ul limit.  Memory
+   only runs out, and the VM system only starts evicting, when
+   both pools are short at once.
+
+   Each pool is managed as a binary buddy system.  Its free pages
+   are kept as blocks of 2**K pages, for orders K from 0 to
+   MAX_ORDER, each aligned to its size in physical memory and
+   each on the pool's free list for its order.  An allocation of
+   N pages takes a block of the smallest order that holds N
+   pages, splitting a larger block in halves if need be, and
+   frees the pages past N right away.  A freed block is merged
+   with its "buddy", the other half of the block of the next
+   order, for as long as the buddy is free and owned by the same
+   pool.  Both take O(log n) time, and runs of contiguous pages
+   stay available instead of being broken up by first-fit
+   allocation.  Because pages are numbered by physical
+   address, a block of 1024 pages is also a 4 MB block that a
+   single large page can map; the VM system builds those up one
+   page at a time with palloc_get_page_in_block() and
+   palloc_get_page_at().
+
+   Free blocks are linked through a list_elem at the start of
+   their first page.  The order of each free block is also
+   recorded, by its first page, in the ORDERS array, so that we
+   can tell whether a buddy is free.
+
+   Most user pages are zeroed before use.  So that this need not
+   happen on the page fault path, the idle thread takes free user
+   pages, zeroes them and keeps up to ZEROED_PAGES of them ready
+   for palloc_get_zeroed_page().  The idle thread must never
+   block, so these pages are protected by turning interrupts off
+   instead of by a lock. */
+
+/* Largest block order. */
+#define MAX_ORDER 16
+
+/* Order and size of the chunks lent between pools.  A chunk
+   covers whole words of USED_MAP, so the pools never share one. */
+#define CHUNK_ORDER 6
+#define CHUNK_PAGES (1u << CHUNK_ORDER)
+
+/* ORDERS entry of a page that does not start a free block. */
+#define NOT_FREE UINT8_MAX
+
+/* Maximum number of pre-zeroed user pages. */
+#define ZEROED_PAGES 32
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
-    struct bitmap *used_map;            /* Bitmap of free pages. */
-    uint8_t *base;                      /* Base of pool. */
+    struct list free_lists[MAX_ORDER + 1]; /* Free blocks of each order. */
+    size_t page_cnt;                    /* Pages owned, free or not. */
+    size_t min_pages;                   /* Never lends below this. */
+    size_t max_pages;                   /* Never borrows beyond this. */
+    long long borrow_cnt;               /* Chunks borrowed. */
+  };
+
+/* A free block. */
+struct free_block
+  {
+    struct list_elem elem;              /* Element in a free list. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
-static void init_pool (struct pool *, void *base, size_t page_cnt,
-                       const char *name);
+/* The memory managed by both pools, indexed by physical page
+   number.  Pages below the pools, which hold the kernel and this
+   metadata, are marked used and never freed.  Changes to ORDERS
+   and USED_MAP are protected by the lock of the pool that owns
+   the pages, changes to OWNERS by the locks of both pools. */
+static uint8_t *base;                   /* Page 0. */
+static size_t total_pages;              /* Number of pages. */
+static struct bitmap *used_map;         /* Bitmap of allocated pages. */
+static uint8_t *orders;                 /* Order of each free block. */
+static struct pool **owners;            /* Owning pool of each chunk. */
+
+/* User pages zeroed by the idle thread.  They are allocated as
+   far as the pools are concerned. */
+static void *zeroed_pages[ZEROED_PAGES];
+static size_t zeroed_cnt;
+
+static void init_pool (struct pool *, size_t page_idx, size_t page_cnt,
+                       size_t min_pages, size_t max_pages, const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static bool borrow_chunk (struct pool *);
+static size_t alloc_pages (struct pool *, unsigned order, size_t page_cnt);
+static size_t get_block (struct pool *, unsigned order);
+static void free_block (struct pool *, size_t page_idx, unsigned order);
+static void free_range (struct pool *, size_t page_idx, size_t page_cnt);
+static bool take_page (struct pool *, size_t page_idx);
+static void *take_zeroed_page (void);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -47,18 +130,42 @@ palloc_init (size_t user_page_limit)
 {
   /* Free memory starts at 1 MB and runs to the end of RAM. */
   uint8_t *free_start = ptov (1024 * 1024);
-  uint8_t *free_end = ptov (init_ram_pages * PGSIZE);
-  size_t free_pages = (free_end - free_start) / PGSIZE;
-  size_t user_pages = free_pages / 2;
-  size_t kernel_pages;
+  size_t chunk_cnt = DIV_ROUND_UP (init_ram_pages, CHUNK_PAGES);
+  size_t bm_size = bitmap_buf_size (init_ram_pages);
+  size_t meta_pages = DIV_ROUND_UP (bm_size + init_ram_pages
+                                    + chunk_cnt * sizeof *owners, PGSIZE);
+  size_t first_idx, free_pages, user_pages, split_idx;
+
+  /* We'll put owners, used_map and orders at the start of free
+     memory, and manage the pages after them. */
+  base = ptov (0);
+  total_pages = init_ram_pages;
+  first_idx = vtop (free_start) / PGSIZE + meta_pages;
+  if (first_idx >= total_pages)
+    PANIC ("Not enough memory for page allocator.");
+  free_pages = total_pages - first_idx;
+  owners = (struct pool **) free_start;
+  memset (owners, 0, chunk_cnt * sizeof *owners);
+  used_map = bitmap_create_in_buf (total_pages,
+                                   owners + chunk_cnt, bm_size);
+  bitmap_set_multiple (used_map, 0, first_idx, true);
+  orders = (uint8_t *) (owners + chunk_cnt) + bm_size;
+  memset (orders, NOT_FREE, total_pages);
+
+  /* Give half of memory to kernel, half to user, splitting at a
+     chunk boundary. */
+  user_pages = free_pages / 2;
   if (user_pages > user_page_limit)
     user_pages = user_page_limit;
-  kernel_pages = free_pages - user_pages;
+  split_idx = ROUND_UP (total_pages - user_pages, CHUNK_PAGES);
+  if (split_idx > total_pages)
+    split_idx = total_pages;
 
-  /* Give half of memory to kernel, half to user. */
-  init_pool (&kernel_pool, free_start, kernel_pages, "kernel pool");
-  init_pool (&user_pool, free_start + kernel_pages * PGSIZE,
-             user_pages, "user pool");
+  init_pool (&kernel_pool, first_idx, split_idx - first_idx,
+             ROUND_UP (free_pages / 8, CHUNK_PAGES), SIZE_MAX,
+             "kernel pool");
+  init_pool (&user_pool, split_idx, total_pages - split_idx, 0,
+             user_page_limit, "user pool");
 }
 
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
@@ -73,18 +180,39 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  unsigned order;
 
   if (page_cnt == 0)
     return NULL;
 
-  lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
-  lock_release (&pool->lock);
+  /* Smallest order that holds PAGE_CNT pages. */
+  for (order = 0; order <= MAX_ORDER && (1u << order) < page_cnt; order++)
+    continue;
 
-  if (page_idx != BITMAP_ERROR)
-    pages = pool->base + PGSIZE * page_idx;
-  else
-    pages = NULL;
+  page_idx = BITMAP_ERROR;
+  if (order <= MAX_ORDER)
+    {
+      lock_acquire (&pool->lock);
+      page_idx = alloc_pages (pool, order, page_cnt);
+      lock_release (&pool->lock);
+
+      /* Under pressure, take memory from the other pool. */
+      if (page_idx == BITMAP_ERROR && order <= CHUNK_ORDER
+          && borrow_chunk (pool))
+        {
+          lock_acquire (&pool->lock);
+          page_idx = alloc_pages (pool, order, page_cnt);
+          lock_release (&pool->lock);
+        }
+    }
+  pages = page_idx != BITMAP_ERROR ? base + PGSIZE * page_idx : NULL;
+
+  /* As a last resort, hand out a page that is already zeroed. */
+  if (pages == NULL && pool == &user_pool && page_cnt == 1)
+    {
+      pages = take_zeroed_page ();
+      flags &= ~PAL_ZERO;
+    }
 
   if (pages != NULL) 
     {
@@ -113,6 +241,98 @@ palloc_get_page (enum palloc_flags flags)
   return palloc_get_multiple (flags, 1);
 }
 
+/* Allocates the user page at PAGE, if it is free, and returns
+   it.  Returns a null pointer if it is not.  The page is not
+   zeroed. */
+void *
+palloc_get_page_at (void *page)
+{
+  size_t page_idx = pg_no (page) - pg_no (base);
+  bool success;
+
+  ASSERT (pg_ofs (page) == 0);
+  if (page_idx >= total_pages)
+    return NULL;
+
+  lock_acquire (&user_pool.lock);
+  success = take_page (&user_pool, page_idx);
+  lock_release (&user_pool.lock);
+  return success ? page : NULL;
+}
+
+/* Finds a free block of BLOCK_PAGES user pages, which must be a
+   power of 2, and allocates page OFS of it, leaving the rest free
+   so that the pages around it can be had later with
+   palloc_get_page_at().  Returns the page, or a null pointer if
+   there is no free block that large.  The page is not zeroed. */
+void *
+palloc_get_page_in_block (size_t block_pages, size_t ofs)
+{
+  size_t page_idx = BITMAP_ERROR;
+  unsigned order;
+
+  ASSERT (ofs < block_pages);
+  for (order = 0; order <= MAX_ORDER && (1u << order) < block_pages; order++)
+    continue;
+  ASSERT ((1u << order) == block_pages);
+
+  lock_acquire (&user_pool.lock);
+  for (; order <= MAX_ORDER; order++)
+    if (!list_empty (&user_pool.free_lists[order]))
+      {
+        struct list_elem *e = list_front (&user_pool.free_lists[order]);
+
+        page_idx = pg_no (list_entry (e, struct free_block, elem))
+                   - pg_no (base) + ofs;
+        if (!take_page (&user_pool, page_idx))
+          NOT_REACHED ();
+        break;
+      }
+  lock_release (&user_pool.lock);
+  return page_idx != BITMAP_ERROR ? base + PGSIZE * page_idx : NULL;
+}
+
+/* Returns a user page that the idle thread has already filled
+   with zeros, or a null pointer if there is none. */
+void *
+palloc_get_zeroed_page (void)
+{
+  return take_zeroed_page ();
+}
+
+/* Called by the idle thread when there is nothing else to do.
+   Takes a free user page, zeroes it and keeps it for
+   palloc_get_zeroed_page().  Returns true if it did so, false if
+   there are enough zeroed pages already or no free page could be
+   had without waiting. */
+bool
+palloc_zero_idle (void)
+{
+  enum intr_level old_level;
+  size_t page_idx = BITMAP_ERROR;
+  void *page;
+
+  /* With interrupts off, no thread can come to wait for the lock
+     while we hold it. */
+  old_level = intr_disable ();
+  if (zeroed_cnt < ZEROED_PAGES && lock_try_acquire (&user_pool.lock))
+    {
+      page_idx = alloc_pages (&user_pool, 0, 1);
+      lock_release (&user_pool.lock);
+    }
+  intr_set_level (old_level);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  page = base + PGSIZE * page_idx;
+  pg_clear (page);
+
+  old_level = intr_disable ();
+  zeroed_pages[zeroed_cnt++] = page;
+  intr_set_level (old_level);
+  return true;
+}
+
 /* Frees the PAGE_CNT pages starting at PAGES. */
 void
 palloc_free_multiple (void *pages, size_t page_cnt) 
@@ -131,14 +351,17 @@ palloc_free_multiple (void *pages, size_t page_cnt)
   else
     NOT_REACHED ();
 
-  page_idx = pg_no (pages) - pg_no (pool->base);
+  page_idx = pg_no (pages) - pg_no (base);
 
 #ifndef NDEBUG
   memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 
-  ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
-  bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+  lock_acquire (&pool->lock);
+  ASSERT (bitmap_all (used_map, page_idx, page_cnt));
+  bitmap_set_multiple (used_map, page_idx, page_cnt, false);
+  free_range (pool, page_idx, page_cnt);
+  lock_release (&pool->lock);
 }
 
 /* Frees the page at PAGE. */
@@ -148,25 +371,55 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
-/* Initializes pool P as starting at START and ending at END,
-   naming it NAME for debugging purposes. */
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void)
+{
+  printf ("Palloc: kernel pool %zu pages, user pool %zu pages, "
+          "%lld chunks borrowed by kernel, %lld by user\n",
+          kernel_pool.page_cnt, user_pool.page_cnt,
+          kernel_pool.borrow_cnt, user_pool.borrow_cnt);
+}
+
+/* Initializes pool P as owning the PAGE_CNT pages starting at
+   PAGE_IDX, naming it NAME for debugging purposes.  No other pool
+   may own pages in the chunks these pages are in.  P lends no
+   pages below MIN_PAGES and borrows none beyond MAX_PAGES. */
 static void
-init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
+init_pool (struct pool *p, size_t page_idx, size_t page_cnt,
+           size_t min_pages, size_t max_pages, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
-     and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
-  if (bm_pages > page_cnt)
-    PANIC ("Not enough memory in %s for bitmap.", name);
-  page_cnt -= bm_pages;
+  size_t chunk;
+  unsigned order;
 
   printf ("%zu pages available in %s.\n", page_cnt, name);
 
-  /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
-  p->base = base + bm_pages * PGSIZE;
+  for (order = 0; order <= MAX_ORDER; order++)
+    list_init (&p->free_lists[order]);
+  p->page_cnt = page_cnt;
+  p->min_pages = min_pages;
+  p->max_pages = max_pages;
+  p->borrow_cnt = 0;
+  for (chunk = page_idx / CHUNK_PAGES;
+       chunk < DIV_ROUND_UP (page_idx + page_cnt, CHUNK_PAGES); chunk++)
+    owners[chunk] = p;
+  free_range (p, page_idx, page_cnt);
+}
+
+/* Removes and returns a pre-zeroed user page, or returns a null
+   pointer if there is none. */
+static void *
+take_zeroed_page (void)
+{
+  enum intr_level old_level;
+  void *page = NULL;
+
+  old_level = intr_disable ();
+  if (zeroed_cnt > 0)
+    page = zeroed_pages[--zeroed_cnt];
+  intr_set_level (old_level);
+  return page;
 }
 
 /* Returns true if PAGE was allocated from POOL,
@@ -175,8 +428,191 @@ static bool
 page_from_pool (const struct pool *pool, void *page) 
 {
   size_t page_no = pg_no (page);
-  size_t start_page = pg_no (pool->base);
-  size_t end_page = start_page + bitmap_size (pool->used_map);
+  size_t start_page = pg_no (base);
+  size_t end_page = start_page + total_pages;
+
+  return (page_no >= start_page && page_no < end_page
+          && owners[(page_no - start_page) / CHUNK_PAGES] == pool);
+}
+
+/* Moves a free chunk from the other pool to POOL, unless that
+   would take the other pool below its minimum or POOL beyond its
+   maximum.  Returns true if successful.  Neither pool's lock may
+   be held by the caller. */
+static bool
+borrow_chunk (struct pool *pool)
+{
+  struct pool *other = pool == &kernel_pool ? &user_pool : &kernel_pool;
+  size_t page_idx = BITMAP_ERROR;
+
+  /* Both locks are always acquired in the same order. */
+  lock_acquire (&kernel_pool.lock);
+  lock_acquire (&user_pool.lock);
+  if (pool->page_cnt + CHUNK_PAGES <= pool->max_pages
+      && other->page_cnt >= other->min_pages + CHUNK_PAGES)
+    page_idx = get_block (other, CHUNK_ORDER);
+  if (page_idx != BITMAP_ERROR)
+    {
+      owners[page_idx / CHUNK_PAGES] = pool;
+      other->page_cnt -= CHUNK_PAGES;
+      pool->page_cnt += CHUNK_PAGES;
+      pool->borrow_cnt++;
+      free_block (pool, page_idx, CHUNK_ORDER);
+    }
+  lock_release (&user_pool.lock);
+  lock_release (&kernel_pool.lock);
+  return page_idx != BITMAP_ERROR;
+}
+
+/* Allocates PAGE_CNT pages from POOL, using a block of 2**ORDER
+   pages, and returns the index of the first one, or BITMAP_ERROR
+   if there is no block large enough.  POOL's lock must be held. */
+static size_t
+alloc_pages (struct pool *pool, unsigned order, size_t page_cnt)
+{
+  size_t page_idx = get_block (pool, order);
+
+  if (page_idx != BITMAP_ERROR)
+    {
+      /* Give back the pages we do not need. */
+      free_range (pool, page_idx + page_cnt, (1u << order) - page_cnt);
+      ASSERT (bitmap_none (used_map, page_idx, page_cnt));
+      bitmap_set_multiple (used_map, page_idx, page_cnt, true);
+    }
+  return page_idx;
+}
+
+/* Returns the free block at PAGE_IDX. */
+static struct free_block *
+idx_to_block (size_t page_idx)
+{
+  return (struct free_block *) (base + PGSIZE * page_idx);
+}
+
+/* Removes a block of 2**ORDER pages from POOL's free lists,
+   splitting a larger block if necessary, and returns the index
+   of its first page.  Returns BITMAP_ERROR if there is no block
+   large enough.  POOL's lock must be held. */
+static size_t
+get_block (struct pool *pool, unsigned order)
+{
+  struct free_block *b;
+  size_t page_idx;
+  unsigned k;
+
+  for (k = order; k <= MAX_ORDER; k++)
+    if (!list_empty (&pool->free_lists[k]))
+      break;
+  if (k > MAX_ORDER)
+    return BITMAP_ERROR;
 
-  return page_no >= start_page && page_no < end_page;
+  b = list_entry (list_pop_front (&pool->free_lists[k]),
+                  struct free_block, elem);
+  page_idx = pg_no (b) - pg_no (base);
+  orders[page_idx] = NOT_FREE;
+
+  /* Put the upper halves back until the block is small enough. */
+  while (k > order)
+    {
+      k--;
+      orders[page_idx + (1u << k)] = k;
+      list_push_front (&pool->free_lists[k],
+                       &idx_to_block (page_idx + (1u << k))->elem);
+    }
+  return page_idx;
+}
+
+/* Removes page PAGE_IDX from POOL's free lists, splitting the
+   free block that holds it, and marks it used.  Returns false if
+   the page is not free or not owned by POOL.  POOL's lock must be
+   held. */
+static bool
+take_page (struct pool *pool, size_t page_idx)
+{
+  size_t block, half;
+  unsigned order;
+
+  /* OWNERS of POOL's chunks, and ORDERS of their pages, cannot
+     change under us.  Those of other chunks are only looked at to
+     decide that a block is not ours. */
+  if (owners[page_idx / CHUNK_PAGES] != pool)
+    return false;
+  for (order = 0; order <= MAX_ORDER; order++)
+    {
+      block = page_idx & ~(((size_t) 1 << order) - 1);
+      if (orders[block] == order)
+        break;
+    }
+  if (order > MAX_ORDER || owners[block / CHUNK_PAGES] != pool)
+    return false;
+
+  list_remove (&idx_to_block (block)->elem);
+  orders[block] = NOT_FREE;
+
+  /* Put back the halves that do not hold PAGE_IDX.  Their buddies
+     are being split, so there is nothing to merge them with. */
+  while (order > 0)
+    {
+      order--;
+      half = block + ((size_t) 1 << order);
+      if (page_idx >= half)
+        {
+          orders[block] = order;
+          list_push_front (&pool->free_lists[order],
+                           &idx_to_block (block)->elem);
+          block = half;
+        }
+      else
+        {
+          orders[half] = order;
+          list_push_front (&pool->free_lists[order],
+                           &idx_to_block (half)->elem);
+        }
+    }
+  ASSERT (!bitmap_test (used_map, page_idx));
+  bitmap_mark (used_map, page_idx);
+  return true;
+}
+
+/* Adds the block of 2**ORDER pages at PAGE_IDX to POOL's free
+   lists, merging it with its buddy as long as the buddy is free
+   and owned by POOL.  POOL's lock must be held. */
+static void
+free_block (struct pool *pool, size_t page_idx, unsigned order)
+{
+  size_t buddy;
+
+  for (; order < MAX_ORDER; order++)
+    {
+      buddy = page_idx ^ (1u << order);
+      if (buddy + (1u << order) > total_pages || orders[buddy] != order
+          || owners[buddy / CHUNK_PAGES] != pool)
+        break;
+      list_remove (&idx_to_block (buddy)->elem);
+      orders[buddy] = NOT_FREE;
+      if (buddy < page_idx)
+        page_idx = buddy;
+    }
+  orders[page_idx] = order;
+  list_push_front (&pool->free_lists[order],
+                   &idx_to_block (page_idx)->elem);
+}
+
+/* Frees the PAGE_CNT pages at PAGE_IDX in POOL as the largest
+   aligned blocks that cover them.  POOL's lock must be held,
+   except during initialization. */
+static void
+free_range (struct pool *pool, size_t page_idx, size_t page_cnt)
+{
+  unsigned order;
+
+  while (page_cnt > 0)
+    {
+      for (order = 0; order < MAX_ORDER; order++)
+        if ((page_idx & (1u << order)) != 0 || (2u << order) > page_cnt)
+          break;
+      free_block (pool, page_idx, order);
+      page_idx += 1u << order;
+      page_cnt -= 1u << order;
+    }
 }
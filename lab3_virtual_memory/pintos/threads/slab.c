@@ -0,0 +1,243 @@
+#include "threads/slab.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* An object cache in the manner of Bonwick's slab allocator.
+
+   Each cache hands out objects of one type.  Objects are carved
+   out of "slabs", single pages from the page allocator that hold
+   a header followed by as many objects as fit.  Unlike malloc(),
+   which rounds every request up to a power of 2, a slab packs
+   objects at their own size, rounded up only to a word.
+
+   The free objects of a slab are chained through an array of
+   indexes in the slab header, so the objects themselves are
+   never written by the allocator.  A cache with a constructor
+   runs it once on each object when its slab is created; objects
+   must be handed back to slab_free() in their constructed state,
+   so the constructor's work is not repeated on every
+   allocation.
+
+   A cache keeps its slabs on three lists: partial, full and
+   empty.  Allocation takes from a partial slab if there is one,
+   so that objects are packed into as few slabs as possible.  A
+   slab that becomes empty is given back to the page allocator,
+   except that one empty slab is kept to avoid thrashing, and
+   none are given back at all by a cache created with SLAB_KEEP.
+   The memory of an object in a SLAB_KEEP cache therefore always
+   holds an object of that type, which lets a thread still look
+   at an object that another thread may have freed. */
+
+/* Magic number for detecting slab corruption. */
+#define SLAB_MAGIC 0x51ab51ab
+
+/* End of a slab's free chain. */
+#define SLAB_END UINT16_MAX
+
+/* Slab header, at the start of each slab's page. */
+struct slab
+  {
+    unsigned magic;             /* Always set to SLAB_MAGIC. */
+    struct slab_cache *cache;   /* Owning cache. */
+    struct list_elem elem;      /* Element in one of the cache's lists. */
+    size_t free_cnt;            /* Number of free objects. */
+    uint16_t free;              /* Index of the first free object. */
+    uint16_t next[];            /* Index of the free object after each one. */
+  };
+
+/* All caches, for statistics. */
+static struct list caches = LIST_INITIALIZER (caches);
+
+static struct slab *new_slab (struct slab_cache *);
+static struct slab *obj_to_slab (struct slab_cache *, void *);
+
+/* Initializes CACHE to hand out objects of SIZE bytes.  NAME
+   identifies the cache in statistics.  If CTOR is nonnull it is
+   called on each object before it is first handed out. */
+void
+slab_cache_init (struct slab_cache *cache, const char *name, size_t size,
+                 void (*ctor) (void *), enum slab_flags flags)
+{
+  size_t n;
+
+  ASSERT (size > 0);
+  cache->name = name;
+  cache->obj_size = ROUND_UP (size, sizeof (void *));
+
+  /* Fit as many objects as possible after the header. */
+  n = (PGSIZE - sizeof (struct slab)) / (cache->obj_size + sizeof (uint16_t));
+  while (ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                   sizeof (void *)) + n * cache->obj_size > PGSIZE)
+    n--;
+  ASSERT (n > 0 && n < SLAB_END);
+  cache->objs_per_slab = n;
+  cache->obj_ofs = ROUND_UP (sizeof (struct slab) + n * sizeof (uint16_t),
+                             sizeof (void *));
+
+  cache->ctor = ctor;
+  cache->flags = flags;
+  lock_init (&cache->lock);
+  list_init (&cache->partial_slabs);
+  list_init (&cache->full_slabs);
+  list_init (&cache->empty_slabs);
+  cache->slab_cnt = 0;
+  cache->used_cnt = 0;
+  cache->alloc_cnt = 0;
+  list_push_back (&caches, &cache->elem);
+}
+
+/* Obtains and returns a new object from CACHE.
+   Returns a null pointer if memory is not available. */
+void *
+slab_alloc (struct slab_cache *cache)
+{
+  struct slab *s;
+  size_t idx;
+
+  lock_acquire (&cache->lock);
+  if (!list_empty (&cache->partial_slabs))
+    s = list_entry (list_front (&cache->partial_slabs), struct slab, elem);
+  else if (!list_empty (&cache->empty_slabs))
+    {
+      s = list_entry (list_pop_front (&cache->empty_slabs), struct slab, elem);
+      list_push_front (&cache->partial_slabs, &s->elem);
+    }
+  else
+    {
+      s = new_slab (cache);
+      if (s == NULL)
+        {
+          lock_release (&cache->lock);
+          return NULL;
+        }
+      list_push_front (&cache->partial_slabs, &s->elem);
+    }
+
+  idx = s->free;
+  ASSERT (idx != SLAB_END);
+  s->free = s->next[idx];
+  if (--s->free_cnt == 0)
+    {
+      list_remove (&s->elem);
+      list_push_front (&cache->full_slabs, &s->elem);
+    }
+  cache->used_cnt++;
+  cache->alloc_cnt++;
+  lock_release (&cache->lock);
+
+  return (uint8_t *) s + cache->obj_ofs + idx * cache->obj_size;
+}
+
+/* Obtains a new object from CACHE, which must not have a
+   constructor, and zeroes it.
+   Returns a null pointer if memory is not available. */
+void *
+slab_zalloc (struct slab_cache *cache)
+{
+  void *p;
+
+  ASSERT (cache->ctor == NULL);
+  p = slab_alloc (cache);
+  if (p != NULL)
+    memset (p, 0, cache->obj_size);
+  return p;
+}
+
+/* Returns object P, which must have been obtained from CACHE, to
+   CACHE.  Does nothing if P is a null pointer. */
+void
+slab_free (struct slab_cache *cache, void *p)
+{
+  struct slab *s;
+  size_t idx;
+
+  if (p == NULL)
+    return;
+  s = obj_to_slab (cache, p);
+  idx = ((uint8_t *) p - ((uint8_t *) s + cache->obj_ofs)) / cache->obj_size;
+
+  lock_acquire (&cache->lock);
+  s->next[idx] = s->free;
+  s->free = idx;
+  cache->used_cnt--;
+  if (s->free_cnt++ == 0)
+    {
+      /* Was full. */
+      list_remove (&s->elem);
+      list_push_front (&cache->partial_slabs, &s->elem);
+    }
+  if (s->free_cnt == cache->objs_per_slab)
+    {
+      list_remove (&s->elem);
+      if ((cache->flags & SLAB_KEEP) || list_empty (&cache->empty_slabs))
+        list_push_front (&cache->empty_slabs, &s->elem);
+      else
+        {
+          cache->slab_cnt--;
+          s->magic = 0;
+          palloc_free_page (s);
+        }
+    }
+  lock_release (&cache->lock);
+}
+
+/* Prints slab statistics. */
+void
+slab_print_stats (void)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&caches); e != list_end (&caches); e = list_next (e))
+    {
+      struct slab_cache *c = list_entry (e, struct slab_cache, elem);
+      printf ("Slab %s: %zu-byte objects, %zu per slab, %zu slabs, "
+              "%zu in use, %lld allocations\n",
+              c->name, c->obj_size, c->objs_per_slab, c->slab_cnt,
+              c->used_cnt, c->alloc_cnt);
+    }
+}
+
+/* Creates a slab for CACHE, whose lock must be held, with all its
+   objects free and constructed.  Returns a null pointer if memory
+   is not available. */
+static struct slab *
+new_slab (struct slab_cache *cache)
+{
+  struct slab *s;
+  size_t i;
+
+  s = palloc_get_page (0);
+  if (s == NULL)
+    return NULL;
+  s->magic = SLAB_MAGIC;
+  s->cache = cache;
+  s->free_cnt = cache->objs_per_slab;
+  s->free = 0;
+  for (i = 0; i < cache->objs_per_slab; i++)
+    {
+      s->next[i] = i + 1 < cache->objs_per_slab ? i + 1 : SLAB_END;
+      if (cache->ctor != NULL)
+        cache->ctor ((uint8_t *) s + cache->obj_ofs + i * cache->obj_size);
+    }
+  cache->slab_cnt++;
+  return s;
+}
+
+/* Returns the slab that object P of CACHE is inside. */
+static struct slab *
+obj_to_slab (struct slab_cache *cache, void *p)
+{
+  struct slab *s = pg_round_down (p);
+
+  /* Check that the slab is valid and P is an object in it. */
+  ASSERT (s->magic == SLAB_MAGIC);
+  ASSERT (s->cache == cache);
+  ASSERT (pg_ofs (p) >= cache->obj_ofs);
+  ASSERT ((pg_ofs (p) - cache->obj_ofs) % cache->obj_size == 0);
+
+  return s;
+}
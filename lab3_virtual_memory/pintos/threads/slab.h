@@ -0,0 +1,43 @@
+#ifndef THREADS_SLAB_H
+#define THREADS_SLAB_H
+
+#include <list.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "threads/synch.h"
+
+/* Flags for slab_cache_init(). */
+enum slab_flags
+  {
+    SLAB_KEEP = 001             /* Never give slabs back to palloc. */
+  };
+
+/* A cache of objects of one type and size. */
+struct slab_cache
+  {
+    const char *name;           /* Name, for statistics. */
+    size_t obj_size;            /* Size of an object in bytes. */
+    size_t objs_per_slab;       /* Number of objects in a slab. */
+    size_t obj_ofs;             /* Offset of the first object in a slab. */
+    void (*ctor) (void *);      /* Constructor, or a null pointer. */
+    enum slab_flags flags;
+    struct lock lock;           /* Protects the lists and counters. */
+    struct list partial_slabs;  /* Slabs with used and free objects. */
+    struct list full_slabs;     /* Slabs with no free objects. */
+    struct list empty_slabs;    /* Slabs with no used objects. */
+    struct list_elem elem;      /* Element in the list of all caches. */
+
+    /* Statistics. */
+    size_t slab_cnt;            /* Slabs held by the cache. */
+    size_t used_cnt;            /* Objects allocated. */
+    long long alloc_cnt;        /* Calls to slab_alloc(). */
+  };
+
+void slab_cache_init (struct slab_cache *, const char *name, size_t size,
+                      void (*ctor) (void *), enum slab_flags);
+void *slab_alloc (struct slab_cache *) __attribute__ ((malloc));
+void *slab_zalloc (struct slab_cache *) __attribute__ ((malloc));
+void slab_free (struct slab_cache *, void *);
+void slab_print_stats (void);
+
+#endif /* threads/slab.h */
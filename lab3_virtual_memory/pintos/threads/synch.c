@@ -239,19 +239,29 @@ lock_acquire (struct lock *lock)
    on failure.  The lock must not already be held by the current
    thread.
 
-   This function will not sleep, so it may be called within an
-   interrupt handler. */
+   This function will not sleep, but it must not be called within
+   an interrupt handler, because the lock is recorded as owned by
+   the running thread for priority donation. */
 bool
 lock_try_acquire (struct lock *lock)
 {
+  enum intr_level old_level;
   bool success;
 
   ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+      /* Track the lock like lock_acquire() so lock_release() finds
+         it in the owned list. */
+      thread_lock_acquired (lock);
+    }
+  intr_set_level (old_level);
   return success;
 }
 
@@ -418,3 +428,71 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+/* Initializes RW, a readers-writer lock.  Any number of readers
+   may hold it at once, or a single writer.  A writer that is
+   waiting keeps new readers out, so that writers do not starve.
+   Neither kind of holder may acquire RW again. */
+void
+rw_lock_init (struct rw_lock *rw)
+{
+  ASSERT (rw != NULL);
+
+  lock_init (&rw->lock);
+  cond_init (&rw->readers_ok);
+  cond_init (&rw->writer_ok);
+  rw->reader_cnt = 0;
+  rw->writer_waiting_cnt = 0;
+  rw->writer = false;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rw_lock_acquire_read (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  while (rw->writer || rw->writer_waiting_cnt > 0)
+    cond_wait (&rw->readers_ok, &rw->lock);
+  rw->reader_cnt++;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rw_lock_release_read (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->reader_cnt > 0);
+  if (--rw->reader_cnt == 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no one else holds
+   it. */
+void
+rw_lock_acquire_write (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  rw->writer_waiting_cnt++;
+  while (rw->writer || rw->reader_cnt > 0)
+    cond_wait (&rw->writer_ok, &rw->lock);
+  rw->writer_waiting_cnt--;
+  rw->writer = true;
+  lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rw_lock_release_write (struct rw_lock *rw)
+{
+  lock_acquire (&rw->lock);
+  ASSERT (rw->writer);
+  rw->writer = false;
+  if (rw->writer_waiting_cnt > 0)
+    cond_signal (&rw->writer_ok, &rw->lock);
+  else
+    cond_broadcast (&rw->readers_ok, &rw->lock);
+  lock_release (&rw->lock);
+}
@@ -688,6 +688,14 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* No other thread is ready.  Use the time to zero free pages
+         for later page faults, until we are preempted or run out
+         of work. */
+      intr_enable ();
+      while (palloc_zero_idle ())
+        continue;
+      intr_disable ();
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
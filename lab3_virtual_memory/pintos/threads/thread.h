@@ -163,8 +163,14 @@ struct thread
     /* Table of memory mapped files. */
     struct mmap *mfiles;
 
+    /* Tree of the regions of the address space, see vm/region.h. */
+    struct region *regions;
+
     /* User stack pointer used for dynamic stack growth. */
     void *user_esp;
+
+    /* User context of the system call in progress, used by fork. */
+    struct intr_frame *user_if;
 #endif
 #ifdef FILESYS
     /* The current working directory. */
@@ -45,6 +45,27 @@ static inline void *pg_next_page (const void *va) {
   return (void *) (((uintptr_t) va + PGSIZE) & ~PGMASK);
 }
 
+/* Copies the page at SRC to the page at DST.  Both must be page
+   aligned and must not overlap.  Unlike memcpy(), needs no
+   alignment head or tail. */
+static inline void pg_copy (void *dst, const void *src) {
+  size_t words = PGSIZE / sizeof (uint32_t);
+
+  ASSERT (pg_ofs (dst) == 0 && pg_ofs (src) == 0);
+  asm volatile ("rep movsl"
+                : "+D" (dst), "+S" (src), "+c" (words) : : "memory");
+}
+
+/* Fills the page at PAGE, which must be page aligned, with
+   zeros. */
+static inline void pg_clear (void *page) {
+  size_t words = PGSIZE / sizeof (uint32_t);
+
+  ASSERT (pg_ofs (page) == 0);
+  asm volatile ("rep stosl"
+                : "+D" (page), "+c" (words) : "a" (0) : "memory");
+}
+
 #define WORDSHIFT 0
 #define WORDBITS  2     
 #define WORDSIZE  (1 << WORDBITS)                /* Bytes in a word. */
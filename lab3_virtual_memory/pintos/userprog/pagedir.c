@@ -8,8 +8,29 @@
 #include "vm/page.h"
 #include "vm/frame.h"
 
+/* Large pages.
+
+   A user page directory can map a naturally aligned 4 MB of user
+   memory with a single 4 MB page, once all of its pages are
+   mapped with the same permissions to 4 MB of contiguous,
+   aligned physical memory (see pagedir_promote()).  The page
+   table stays in place behind the large page and its entries are
+   kept up to date, apart from the accessed and dirty bits, which
+   the CPU then sets in the PDE.  Those functions that read these
+   bits also take the PDE's into account, and those that clear
+   them first copy the PDE's into every PTE.  Any other change to
+   a page turns the large page back into the page table first.
+
+   Since a large PDE no longer points to its page table, every
+   user page directory has a second page that holds a pointer to
+   each of its page tables. */
+
 static uint32_t *active_pd (void);
-static void invalidate_pagedir (uint32_t *);
+static void invalidate_page (uint32_t *, const void *);
+static uint32_t **page_tables (uint32_t *pd);
+static void demote (uint32_t *pd, const void *vaddr);
+static void fold_bits (uint32_t *pd, const void *vaddr, uint32_t bits);
+static uint32_t large_bits (uint32_t *pd, const void *vaddr);
 
 /* Creates a new page directory that has mappings for kernel
    virtual addresses, but none for user virtual addresses.
@@ -18,9 +39,12 @@ static void invalidate_pagedir (uint32_t *);
 uint32_t *
 pagedir_create (void) 
 {
-  uint32_t *pd = palloc_get_page (0);
+  uint32_t *pd = palloc_get_multiple (0, 2);
   if (pd != NULL)
-    memcpy (pd, init_page_dir, PGSIZE);
+    {
+      pg_copy (pd, init_page_dir);
+      pg_clear (page_tables (pd));
+    }
   return pd;
 }
 
@@ -42,16 +66,16 @@ pagedir_destroy (uint32_t *pd)
   for (ubase = 0, pde = pd; pde < pd + pd_no (PHYS_BASE);
        ubase += PTSPAN, pde++)
     {
-      if (*pde & PTE_P)
+      pt = page_tables (pd)[pde - pd];
+      if (pt != NULL)
         {
-          pt = pde_get_pt (*pde);
           for (upage = ubase, pte = pt; pte < pt + PGSIZE / sizeof *pte;
                upage += PGSIZE, pte++)
               pagedir_unload_page (pd, upage);
           palloc_free_multiple (pt, 2);
         }
     }
-  palloc_free_page (pd);
+  palloc_free_multiple (pd, 2);
 }
 
 /* Returns the address of the page table entry for virtual
@@ -71,10 +95,17 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
   /* Shouldn't create new kernel virtual mappings. */
   ASSERT (!create || is_user_vaddr (vaddr));
 
+  /* Kernel mappings are the same in every page directory and
+     have no entry in page_tables(). */
+  pde = pd + pd_no (vaddr);
+  if (!is_user_vaddr (vaddr))
+    return ((*pde & PTE_P) && !(*pde & PTE_PS)
+            ? &pde_get_pt (*pde)[pt_no (vaddr)] : NULL);
+
   /* Check for a page table for VADDR.
      If one is missing, create one if requested. */
-  pde = pd + pd_no (vaddr);
-  if (*pde == 0) 
+  pt = page_tables (pd)[pd_no (vaddr)];
+  if (pt == NULL) 
     {
       if (create)
         {
@@ -83,13 +114,13 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
             return NULL; 
       
           *pde = pde_create (pt);
+          page_tables (pd)[pd_no (vaddr)] = pt;
         }
       else
         return NULL;
     }
 
   /* Return the page table entry. */
-  pt = pde_get_pt (*pde);
   return &pt[pt_no (vaddr)];
 }
 
@@ -158,8 +189,9 @@ pagedir_clear_page (uint32_t *pd, const void *upage)
   pte = lookup_page (pd, upage, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
     {
+      demote (pd, upage);
       *pte &= ~PTE_P;
-      invalidate_pagedir (pd);
+      invalidate_page (pd, upage);
     }
 }
 
@@ -171,7 +203,7 @@ bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_D) != 0;
+  return pte != NULL && ((*pte | large_bits (pd, vpage)) & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
@@ -186,12 +218,40 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
         *pte |= PTE_D;
       else 
         {
+          fold_bits (pd, vpage, PTE_D);
           *pte &= ~(uint32_t) PTE_D;
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
+/* Sets the writable bit to WRITABLE in the PTE for virtual page
+   VPAGE in PD. */
+void
+pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte != NULL)
+    {
+      demote (pd, vpage);
+      if (writable)
+        *pte |= PTE_W;
+      else
+        *pte &= ~(uint32_t) PTE_W;
+      /* A stale read-only entry would fault even on kernel
+         writes, so flush in both directions. */
+      invalidate_page (pd, vpage);
+    }
+}
+
+/* Returns true if PD maps virtual page VPAGE writable. */
+bool
+pagedir_is_writable (uint32_t *pd, const void *vpage)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_W)) == (PTE_P | PTE_W);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
    installed and the last time it was cleared.  Returns false if
@@ -200,7 +260,7 @@ bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
   uint32_t *pte = lookup_page (pd, vpage, false);
-  return pte != NULL && (*pte & PTE_A) != 0;
+  return pte != NULL && ((*pte | large_bits (pd, vpage)) & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
@@ -215,19 +275,24 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
         *pte |= PTE_A;
       else 
         {
+          fold_bits (pd, vpage, PTE_A);
           *pte &= ~(uint32_t) PTE_A; 
-          invalidate_pagedir (pd);
+          invalidate_page (pd, vpage);
         }
     }
 }
 
 /* Loads page directory PD into the CPU's page directory base
-   register. */
+   register, unless it is loaded already.  Loading a page
+   directory flushes the TLB of all but the global kernel
+   mappings. */
 void
 pagedir_activate (uint32_t *pd) 
 {
   if (pd == NULL)
     pd = init_page_dir;
+  if (active_pd () == pd)
+    return;
 
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
@@ -237,6 +302,42 @@ pagedir_activate (uint32_t *pd)
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
 }
 
+/* Maps the 4 MB of PD that hold UPAGE with a single large page,
+   if all of their pages are mapped with the same permissions to
+   4 MB of physical memory that is contiguous and aligned to 4 MB
+   and if the CPU has large pages turned on.  Returns true if
+   successful, false otherwise. */
+bool
+pagedir_promote (uint32_t *pd, const void *upage)
+{
+  uint32_t *pde = pd + pd_no (upage);
+  uint32_t *pt = page_tables (pd)[pd_no (upage)];
+  uint32_t cr4, first, want;
+  size_t i;
+
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  asm ("movl %%cr4, %0" : "=r" (cr4));
+  if (!(cr4 & CR4_PSE) || pt == NULL || (*pde & PTE_PS))
+    return false;
+
+  first = pt[0];
+  if (!(first & PTE_P) || (first & PTE_ADDR) % PTSPAN != 0)
+    return false;
+  for (i = 1; i < PGSIZE / sizeof *pt; i++)
+    {
+      want = (first & (PTE_ADDR | PTE_P | PTE_W | PTE_U)) + i * PGSIZE;
+      if ((pt[i] & (PTE_ADDR | PTE_P | PTE_W | PTE_U)) != want)
+        return false;
+    }
+
+  /* The 4 kB entries still in the TLB map the same memory the
+     same way, so there is nothing to invalidate. */
+  *pde = (first & (PTE_ADDR | PTE_P | PTE_W | PTE_U)) | PTE_PS;
+  return true;
+}
+
 /* Returns the currently active page directory. */
 static uint32_t *
 active_pd (void) 
@@ -252,23 +353,87 @@ active_pd (void)
 
 /* Some page table changes can cause the CPU's translation
    lookaside buffer (TLB) to become out-of-sync with the page
-   table.  When this happens, we have to "invalidate" the TLB by
-   re-activating it.
-
-   This function invalidates the TLB if PD is the active page
-   directory.  (If PD is not active then its entries are not in
-   the TLB, so there is no need to invalidate anything.) */
+   table.  When this happens, we have to "invalidate" the stale
+   TLB entry.
+
+   This function invalidates the TLB entry for VADDR if PD is the
+   active page directory.  (If PD is not active then its entries
+   are not in the TLB, so there is no need to invalidate
+   anything.)  Only the one entry is flushed, so the rest of the
+   TLB stays warm.  Kernel threads run on whichever page
+   directory was active before them, so PD may be active even if
+   it does not belong to the running thread. */
 static void
-invalidate_pagedir (uint32_t *pd) 
+invalidate_page (uint32_t *pd, const void *vaddr) 
 {
   if (active_pd () == pd) 
     {
-      /* Re-activating PD clears the TLB.  See [IA32-v3a] 3.12
-         "Translation Lookaside Buffers (TLBs)". */
-      pagedir_activate (pd);
+      /* See [IA32-v2a] "INVLPG--Invalidate TLB Entry" and
+         [IA32-v3a] 3.12 "Translation Lookaside Buffers
+         (TLBs)". */
+      asm volatile ("invlpg %0" : : "m" (*(const char *) vaddr) : "memory");
     } 
 }
 
+/* Returns the array of pointers to the page tables of user page
+   directory PD, in the page after it. */
+static uint32_t **
+page_tables (uint32_t *pd)
+{
+  return pg_next_page (pd);
+}
+
+/* If the 4 MB of PD that hold VADDR are mapped with a large page,
+   goes back to their page table, with the large page's accessed
+   and dirty bits copied into every entry. */
+static void
+demote (uint32_t *pd, const void *vaddr)
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+
+  if (*pde & PTE_PS)
+    {
+      uint32_t *pt = page_tables (pd)[pd_no (vaddr)];
+
+      fold_bits (pd, vaddr, PTE_A | PTE_D);
+      *pde = pde_create (pt);
+      invalidate_page (pd, vaddr);
+    }
+}
+
+/* If the 4 MB of PD that hold VADDR are mapped with a large page,
+   moves those of BITS, a combination of PTE_A and PTE_D, that are
+   set in its PDE into every entry of its page table. */
+static void
+fold_bits (uint32_t *pd, const void *vaddr, uint32_t bits)
+{
+  uint32_t *pde = pd + pd_no (vaddr);
+
+  bits &= *pde;
+  if ((*pde & PTE_PS) && bits != 0)
+    {
+      uint32_t *pt = page_tables (pd)[pd_no (vaddr)];
+      size_t i;
+
+      for (i = 0; i < PGSIZE / sizeof *pt; i++)
+        pt[i] |= bits;
+      *pde &= ~bits;
+
+      /* Make the CPU set the bits in the PDE again. */
+      invalidate_page (pd, vaddr);
+    }
+}
+
+/* Returns the accessed and dirty bits of the large page that maps
+   VADDR in PD, or 0 if there is none. */
+static uint32_t
+large_bits (uint32_t *pd, const void *vaddr)
+{
+  uint32_t pde = pd[pd_no (vaddr)];
+
+  return pde & PTE_PS ? pde & (PTE_A | PTE_D) : 0;
+}
+
 /* Clears the page table entry, frees the associated frame, 
    unloads the associated frame, and frees the page info. */
 void
@@ -335,4 +500,26 @@ pagedir_get_info (uint32_t *pd, const void *upage)
     }
   else
     return NULL;
-}
\ No newline at end of file
+}
+/* Calls FUNC with AUX for the page information of every user page
+   in PD that has some, in order of address.  Stops as soon as FUNC
+   returns false and returns false; returns true otherwise. */
+bool
+pagedir_for_each_info (uint32_t *pd,
+                       bool (*func) (struct page_info *, void *aux),
+                       void *aux)
+{
+  uint32_t *pde;
+  struct page_info **pie, **pie_end;
+
+  ASSERT (pd != init_page_dir);
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (page_tables (pd)[pde - pd] != NULL)
+      {
+        pie = pg_next_page (page_tables (pd)[pde - pd]);
+        for (pie_end = pie + PGSIZE / sizeof *pie; pie < pie_end; pie++)
+          if (*pie != NULL && !func (*pie, aux))
+            return false;
+      }
+  return true;
+}
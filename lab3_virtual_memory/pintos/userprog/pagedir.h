@@ -13,11 +13,17 @@ void *pagedir_get_page (uint32_t *pd, const void *uaddr);
 void pagedir_clear_page (uint32_t *pd, const void *upage);
 bool pagedir_is_dirty (uint32_t *pd, const void *vpage);
 void pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty);
+void pagedir_set_writable (uint32_t *pd, const void *vpage, bool writable);
+bool pagedir_is_writable (uint32_t *pd, const void *vpage);
 bool pagedir_is_accessed (uint32_t *pd, const void *vpage);
 void pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed);
 void pagedir_activate (uint32_t *pd);
+bool pagedir_promote (uint32_t *pd, const void *upage);
 void pagedir_unload_page (uint32_t *pd, const void *upage);
 bool pagedir_set_info (uint32_t *pd, const void *upage, struct page_info *info);
 struct page_info *pagedir_get_info (uint32_t *pd, const void *upage);
+bool pagedir_for_each_info (uint32_t *pd,
+                            bool (*func) (struct page_info *, void *aux),
+                            void *aux);
 
 #endif /* userprog/pagedir.h */
\ No newline at end of file
@@ -18,8 +18,10 @@
 #include "threads/malloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/mmap.h"
+#include "vm/region.h"
 
 /* Maximum size of program arguments. */
 #define MAX_ARGS_SIZE 512
@@ -33,7 +35,20 @@ struct start_args
   struct thread *child;
 };
 
+/* Arguments passed from fork() to the child process. */
+struct fork_args
+{
+  const struct intr_frame *if_;   /* Parent's user context. */
+  struct thread *parent;
+  struct semaphore start_wait;
+  struct thread *child;
+};
+
 static thread_func start_process NO_RETURN;
+static thread_func start_fork NO_RETURN;
+static bool fork_region (struct region *r, void *parent);
+static bool fork_page (struct page_info *page_info, void *parent);
+static struct file *fork_file (struct thread *parent, struct file *file);
 static bool load (char *program_name, char *program_args, void (**eip) (void),
                   void **esp);
 
@@ -114,6 +129,132 @@ start_process (void *args_)
   NOT_REACHED ();
 }
 
+/* Starts a new process that is a copy of the current one and
+   resumes, like the current process, from the system call whose
+   user context is IF_, returning 0 there.  Writable pages are
+   shared copy-on-write rather than copied.  Open files are
+   inherited; memory mapped files are not.  Returns the new
+   process's thread id, or TID_ERROR if it cannot be created. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct thread *cur = thread_current ();
+  struct fork_args args;
+  tid_t tid;
+
+  args.if_ = if_;
+  args.parent = cur;
+  sema_init (&args.start_wait, 0);
+  tid = thread_create (cur->name, PRI_DEFAULT, start_fork, &args);
+  if (tid != TID_ERROR)
+    {
+      /* Our address space must not change while the child copies
+         it, and the child must be added to the child list. */
+      sema_down (&args.start_wait);
+      if (args.child != NULL)
+        list_push_back (&cur->child_list, &args.child->child_elem);
+      else
+        tid = TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that copies the parent's process and starts
+   it running. */
+static void
+start_fork (void *args_)
+{
+  struct thread *cur = thread_current ();
+  struct fork_args *args = args_;
+  struct thread *parent = args->parent;
+  struct intr_frame if_ = *args->if_;
+  bool success = false;
+
+  cur->pagedir = pagedir_create ();
+  if (cur->pagedir == NULL)
+    goto done;
+  process_activate ();
+
+  cur->ofiles = calloc (MAX_OPEN_FILES, sizeof *cur->ofiles);
+  if (cur->ofiles == NULL)
+    goto done;
+  cur->mfiles = calloc (MAX_MMAP_FILES, sizeof *cur->mfiles);
+  if (cur->mfiles == NULL)
+    goto done;
+  if (!process_file_inherit (parent->ofiles)
+      || !region_for_each (parent->regions, fork_region, parent)
+      || !pagedir_for_each_info (parent->pagedir, fork_page, parent))
+    goto done;
+  cur->ptid = parent->tid;
+  success = true;
+
+ done:
+  args->child = success ? cur : NULL;
+  sema_up (&args->start_wait);
+
+  /* If copying failed, quit. */
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Adds a copy of region R of process PARENT to the current
+   process.  Regions of memory mapped files are skipped.  Returns
+   false if the region could not be copied. */
+static bool
+fork_region (struct region *r, void *parent_)
+{
+  struct thread *cur = thread_current ();
+  struct file *file = NULL;
+
+  if (r->writable & WRITABLE_TO_FILE)
+    return true;
+  if (r->file != NULL)
+    {
+      file = fork_file (parent_, r->file);
+      if (file == NULL)
+        return false;
+    }
+  return region_add (&cur->regions, r->start, (r->end - r->start) / PGSIZE,
+                     file, r->ofs, r->read_bytes, r->writable);
+}
+
+/* Adds a copy of page PAGE_INFO of process PARENT to the current
+   process.  Pages of memory mapped files are skipped.  Returns
+   false if the page could not be copied. */
+static bool
+fork_page (struct page_info *page_info, void *parent_)
+{
+  struct thread *cur = thread_current ();
+  struct file *file = NULL;
+
+  if (page_info->writable & WRITABLE_TO_FILE)
+    return true;
+  if (page_info->type & PAGE_TYPE_FILE)
+    {
+      file = fork_file (parent_, page_info->data.file_info.file);
+      if (file == NULL)
+        return false;
+    }
+  return frametable_fork_page (page_info, cur->pagedir, file);
+}
+
+/* Returns the current process's copy of FILE, which is open in
+   process PARENT, or a null pointer if there is none. */
+static struct file *
+fork_file (struct thread *parent, struct file *file)
+{
+  int fd;
+
+  for (fd = 2; fd < MAX_OPEN_FILES; fd++)
+    if (parent->ofiles[fd] == file)
+      return thread_current ()->ofiles[fd];
+  return NULL;
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -196,6 +337,7 @@ process_exit (void)
       pagedir_destroy (pd);
       printf ("%s: exit(%d)\n", cur->name, cur->exit_status);
     }
+  region_destroy (&cur->regions);
   if (cur->ofiles != NULL)
     {
       for (fd = 2; fd < MAX_OPEN_FILES; fd++)
@@ -250,8 +392,15 @@ process_activate (void)
 {
   struct thread *cur = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (cur->pagedir);
+  /* Activate thread's page tables.  A kernel thread has none of
+     its own and keeps running on those of the last process, whose
+     kernel mappings are the same as everyone's, so that switching
+     to it and back does not flush the TLB.  A process switches
+     back to the base page directory before destroying its own, so
+     the page directory left loaded is never one that was
+     freed. */
+  if (cur->pagedir != NULL)
+    pagedir_activate (cur->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -510,53 +659,25 @@ validate_segment (const struct Elf32_Phdr *phdr, int fd)
    The pages initialized by this function must be writable by the
    user process if WRITABLE is true, read-only otherwise.
 
-   Return true if successful, false if a memory allocation error occurs.
+   The segment is added as a region and its pages are only set up
+   when they are first touched.
+
+   Return true if successful, false if the segment overlaps another
+   one or a memory allocation error occurs.
 */
 static bool
 load_segment (int fd, off_t ofs, uint8_t *upage,
               uint32_t read_bytes, uint32_t zero_bytes, bool writable) 
 {
   struct thread *cur = thread_current ();
-  struct page_info *page_info;
-  struct file *file;
     
   ASSERT ((read_bytes + zero_bytes) % PGSIZE == 0);
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
-  file = process_file_get_file (fd);
-  while (read_bytes > 0 || zero_bytes > 0) 
-    {
-      page_info = pageinfo_create ();
-      if (page_info == NULL)
-        return false;
-      
-      /* Calculate how to fill this page.
-         We will read PAGE_READ_BYTES bytes from FILE
-         and zero the final PAGE_ZERO_BYTES bytes. */
-      size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-      size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-      pageinfo_set_pagedir (page_info, cur->pagedir);
-      pageinfo_set_upage (page_info, upage);
-      if (page_read_bytes > 0)
-        {
-          ofs += page_read_bytes;
-          pageinfo_set_type (page_info, PAGE_TYPE_FILE);
-          pageinfo_set_fileinfo (page_info, file, ofs);
-        }
-      else
-        pageinfo_set_type (page_info, PAGE_TYPE_ZERO);
-      if (writable)
-        pageinfo_set_writable (page_info, WRITABLE_TO_SWAP);
-      pagedir_set_info (cur->pagedir, upage, page_info);
-      
-      /* Advance. */
-      read_bytes -= page_read_bytes;
-      zero_bytes -= page_zero_bytes;
-      upage += PGSIZE;
-    }
-  return true;
+  return region_add (&cur->regions, upage, (read_bytes + zero_bytes) / PGSIZE,
+                     process_file_get_file (fd), ofs, read_bytes,
+                     writable ? WRITABLE_TO_SWAP : 0);
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -31,6 +31,7 @@ static int sys_tell(const uint8_t *arg_base);
 static int sys_close(const uint8_t *arg_base);
 static int sys_mmap(const uint8_t *arg_base);
 static int sys_munmap(const uint8_t *arg_base);
+static int sys_fork(const uint8_t *arg_base);
 
 static int (*syscalls[])(const uint8_t *arg_base) =
 {
@@ -48,7 +49,8 @@ static int (*syscalls[])(const uint8_t *arg_base) =
   [SYS_TELL] sys_tell,
   [SYS_CLOSE] sys_close,
   [SYS_MMAP] sys_mmap,
-  [SYS_MUNMAP] sys_munmap
+  [SYS_MUNMAP] sys_munmap,
+  [SYS_FORK] sys_fork
 };
 
 void
@@ -170,6 +172,7 @@ syscall_handler (struct intr_frame *f)
   unsigned num;
 
   thread_current ()->user_esp = f->esp;
+  thread_current ()->user_if = f;
   if (!get_int_arg (f->esp, 0, (int *) &num))
     thread_exit ();
   if (num > 0 && num < sizeof syscalls / sizeof *syscalls
@@ -215,6 +218,14 @@ sys_exec (const uint8_t *arg_base)
   return process_execute (cmd_line);
 }
 
+static int
+sys_fork (const uint8_t *arg_base)
+{
+  (void) arg_base;
+
+  return process_fork (thread_current ()->user_if);
+}
+
 static int
 sys_wait (const uint8_t *arg_base)
 {
@@ -0,0 +1,152 @@
+#include <list.h>
+#include "vm/frame.h"
+#include "vm/policy.h"
+
+/* CAR, the clock-based form of ARC, after Bansal and Modha, "CAR:
+   Clock with Adaptive Replacement".
+
+   T1 is a clock of frames whose page has been used once recently
+   and T2 a clock of frames whose page has been used at least twice.
+   B1 and B2 remember the pages recently evicted from T1 and T2.  A
+   fault on a page remembered in B1 means T1 is too small, so the
+   target size P of T1 grows; one remembered in B2 shrinks it.  Such
+   pages go straight to T2.  A scan only fills T1 and B1, so the
+   frequently used pages in T2 survive it.
+
+   The fault that brings a page in also sets its accessed bit, so a
+   new frame is passed over once before its reference bit counts as
+   a second use. */
+
+#define QUEUE_T1 1
+#define QUEUE_T2 2
+
+static struct list t1, t2;              // Clocks, hand at the front
+static size_t t1_cnt, t2_cnt;
+static struct ghost_list b1, b2;        // Pages evicted from t1 and t2
+static size_t target;                   // Target size of t1
+
+static void car_init (void)
+{
+  list_init (&t1);
+  list_init (&t2);
+  ghost_init (&b1);
+  ghost_init (&b2);
+}
+
+static void car_insert (struct frame *frame)
+{
+  size_t c = t1_cnt + t2_cnt + 1;
+  size_t delta;
+
+  frame->fresh = true;
+  if (ghost_remove (&b1, frame))
+    {
+      delta = b2.cnt > b1.cnt && b1.cnt > 0 ? b2.cnt / b1.cnt : 1;
+      target = target + delta < c ? target + delta : c;
+      frame->queue = QUEUE_T2;
+    }
+  else if (ghost_remove (&b2, frame))
+    {
+      delta = b1.cnt > b2.cnt && b2.cnt > 0 ? b1.cnt / b2.cnt : 1;
+      target = target > delta ? target - delta : 0;
+      frame->queue = QUEUE_T2;
+    }
+  else
+    frame->queue = QUEUE_T1;
+
+  if (frame->queue == QUEUE_T1)
+    {
+      list_push_back (&t1, &frame->list_elem);
+      t1_cnt++;
+    }
+  else
+    {
+      list_push_back (&t2, &frame->list_elem);
+      t2_cnt++;
+    }
+
+  /* Keep the history to at most C pages for T1 and B1 and 2C in
+     all. */
+  ghost_trim (&b1, c > t1_cnt ? c - t1_cnt : 0);
+  if (t1_cnt + t2_cnt + b1.cnt + b2.cnt > 2 * c)
+    ghost_trim (&b2, 2 * c - t1_cnt - t2_cnt - b1.cnt);
+}
+
+static void car_access (struct frame *frame)
+{
+  frame->referenced = true;
+}
+
+static void car_remove (struct frame *frame)
+{
+  if (frame->queue == QUEUE_T1)
+    t1_cnt--;
+  else
+    t2_cnt--;
+  list_remove (&frame->list_elem);
+}
+
+static struct frame *car_select (bool *busy)
+{
+  struct frame *f;
+  bool from_t1;
+  size_t i, n;
+
+  /* Each frame moves at most twice before a victim turns up, unless
+     frames are busy or pinned. */
+  n = 3 * (t1_cnt + t2_cnt);
+  for (i = 0; i < n; i++)
+    {
+      from_t1 = t2_cnt == 0 || (t1_cnt > 0 && t1_cnt >= (target > 0 ? target : 1));
+      f = list_entry (list_pop_front (from_t1 ? &t1 : &t2),
+                      struct frame, list_elem);
+      if (!frame_lock_victim (f, busy))
+        {
+          list_push_back (from_t1 ? &t1 : &t2, &f->list_elem);
+          continue;
+        }
+
+      if (f->fresh)
+        {
+          f->fresh = false;
+          frame_referenced (f);
+          list_push_back (from_t1 ? &t1 : &t2, &f->list_elem);
+        }
+      else if (!frame_referenced (f))
+        {
+          if (from_t1)
+            {
+              t1_cnt--;
+              ghost_add (&b1, f);
+            }
+          else
+            {
+              t2_cnt--;
+              ghost_add (&b2, f);
+            }
+          return f;
+        }
+      else if (from_t1)
+        {
+          /* Used again: promote to T2. */
+          t1_cnt--;
+          t2_cnt++;
+          f->queue = QUEUE_T2;
+          list_push_back (&t2, &f->list_elem);
+        }
+      else
+        list_push_back (&t2, &f->list_elem);
+      lock_release (&f->lock);
+    }
+  return NULL;
+}
+
+const struct replacement_policy car_policy =
+  {
+    "car",
+    car_init,
+    car_insert,
+    car_access,
+    car_remove,
+    car_select,
+  };
@@ -0,0 +1,76 @@
+#include <list.h>
+#include "vm/frame.h"
+#include "vm/policy.h"
+
+/* The clock algorithm.  Frames sit on a circular list swept by a
+   hand.  A frame referenced since the hand last passed it gets a
+   second chance; the first one that was not is the victim. */
+
+static struct list frame_list;          // Frames, in clock order
+static struct list_elem *clock_hand;    // Next frame to examine
+
+static void clock_init (void)
+{
+  list_init (&frame_list);
+  clock_hand = list_end (&frame_list);
+}
+
+/* Inserts FRAME just behind the hand, so that it is examined last. */
+static void clock_insert (struct frame *frame)
+{
+  if (!list_empty (&frame_list))
+    list_insert (clock_hand, &frame->list_elem);
+  else
+    {
+      list_push_front (&frame_list, &frame->list_elem);
+      clock_hand = list_begin (&frame_list);
+    }
+}
+
+static void clock_access (struct frame *frame)
+{
+  frame->referenced = true;
+}
+
+static void clock_remove (struct frame *frame)
+{
+  if (clock_hand == &frame->list_elem)
+    clock_hand = list_next (clock_hand);
+  list_remove (&frame->list_elem);
+}
+
+static struct frame *clock_select (bool *busy)
+{
+  struct frame *cur;
+  size_t i, n;
+
+  /* Two sweeps: the first may only clear reference bits. */
+  n = 2 * list_size (&frame_list);
+  for (i = 0; i < n; i++)
+    {
+      if (clock_hand == list_end (&frame_list))
+        clock_hand = list_begin (&frame_list);
+      cur = list_entry (clock_hand, struct frame, list_elem);
+      clock_hand = list_next (clock_hand);
+
+      if (!frame_lock_victim (cur, busy))
+        continue;
+      if (!frame_referenced (cur))
+        {
+          clock_remove (cur);
+          return cur;
+        }
+      lock_release (&cur->lock);
+    }
+  return NULL;
+}
+
+const struct replacement_policy clock_policy =
+  {
+    "clock",
+    clock_init,
+    clock_insert,
+    clock_access,
+    clock_remove,
+    clock_select,
+  };
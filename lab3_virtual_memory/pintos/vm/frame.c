@@ -3,15 +3,20 @@
 #include <list.h>
 #include <hash.h>
 #include <debug.h>
+#include <stdlib.h>
 #include <string.h>
 #include "userprog/pagedir.h"
 #include "vm/page.h"
 #include "vm/frame.h"
+#include "vm/policy.h"
+#include "vm/region.h"
 #include "vm/swap.h"
 #include "threads/palloc.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
 #include "filesys/filesys.h"
@@ -28,29 +33,159 @@ static inline off_t size (off_t end_offset)
   return end_offset - offset (end_offset);
 }
 
-/* Global state for managing physical frames. */
-static struct lock frame_lock;          // Lock to protect frame table operations
+/* Global state for managing physical frames.
+
+   Each frame has its own lock, which protects its page_info_list,
+   its pin count and the frame pointers of the page_infos on that
+   list, and which is held while the frame's page is read in or
+   written out.  The replacement policy and the read-only cache
+   have locks of their own.  A frame lock may be held while
+   acquiring policy_lock or read_only_lock but never the other way
+   around; the policy only tries to acquire frame locks.
+
+   Frame structs come from a SLAB_KEEP cache, so their memory is
+   never handed back to palloc and always holds a frame with an
+   initialized lock.  A thread that read a page_info's frame pointer
+   can therefore always lock that frame, even if it was released in
+   the meantime, and then check that the pointer still refers to
+   it. */
+static const struct replacement_policy *policy = &clock_policy;
+static struct lock policy_lock;         // Serializes calls into the policy
+static struct lock read_only_lock;      // Protects read_only_frames
 static struct hash read_only_frames;    // Cache for shared, read-only file-backed pages
-static struct list frame_list;          // List of frames in use
-static struct list_elem *clock_hand;    // Pointer for clock replacement algorithm
+static struct slab_cache frame_cache;   // Frame structs
+
+/* Free frames evicted ahead of demand by the pageout thread.  When
+   the user pool is empty and cannot borrow from the kernel pool, a
+   fault takes one of these instead of evicting a frame itself.
+   The pageout thread is woken when the reserve drops below
+   pageout_low_water and refills it up to pageout_high_water. */
+size_t pageout_low_water = 4;
+size_t pageout_high_water = 16;
+static struct lock reserve_lock;        // Protects the reserve and pageout_wanted
+static struct list reserve_frames;      // Clean, zeroed, unmapped frames
+static size_t reserve_cnt;              // Number of frames in reserve_frames
+static bool pageout_wanted;             // Whether the pageout thread should run
+static struct condition pageout_cond;   // Signaled when pageout_wanted is set
+static bool pageout_started;            // Whether the pageout thread exists
+
+/* Size of the swap-in read-ahead window in pages, including the
+   faulting page.  Controlled by kernel command-line option
+   "-swap-ra". */
+size_t swap_read_ahead_pages = 8;
+
+/* Fault-around window for read-only file pages, in pages; must be
+   a power of two.  Of these, the pages just after the faulting one
+   are also read in if they are not cached. */
+#define FAULT_AROUND_PAGES 16
+#define FILE_READ_AHEAD_PAGES 4
+
+/* A page of zeros that every zero page is mapped to, read-only,
+   until it is first written.  It belongs to no frame, so the policy
+   never sees it. */
+static void *zero_kpage;
+
+/* Large pages.  A fault in a naturally aligned 4 MB of user
+   memory that lies entirely within one region gets, if possible,
+   the page at the same offset of a 4 MB block of physical memory:
+   the block that pages of the same 4 MB already use, or else a
+   free one.  Once all of the 4 MB is resident this way, it is
+   mapped with a single large page, which pagedir.c splits up
+   again as soon as one of its pages is evicted or changes
+   protection. */
+#define LARGE_PAGES (PTSPAN / PGSIZE)
+
+/* Maximum number of frames the pageout thread evicts at once. */
+#define SWAP_CLUSTER_PAGES 8
+
+/* Statistics. */
+static long long evict_cnt;             // Frames evicted
+static long long busy_skip_cnt;         // Frames skipped by the policy because they were locked
+static long long frame_wait_cnt;        // Times a thread blocked on another thread's frame lock
+static long long pageout_cnt;           // Frames evicted by the pageout thread
+static long long reserve_hit_cnt;       // Allocations served from the reserve
+static long long read_ahead_cnt;        // Pages swapped in by read-ahead
+static long long swap_cache_hit_cnt;    // Evictions that reused a swap cache copy
+static long long fault_around_cnt;      // File pages mapped by fault-around
+static long long cow_share_cnt;         // Resident pages shared copy-on-write by fork
+static long long cow_copy_cnt;          // Shared pages copied on a write
+static long long zero_map_cnt;          // Read faults served by the zero page
+static long long prezeroed_cnt;         // Frames that got a page zeroed by the idle thread
+static long long zero_fill_cnt;         // Frames zeroed on demand
+static long long large_place_cnt;       // Frames placed for a large page
+static long long large_promote_cnt;     // 4 MB ranges mapped with a large page
 
 // Function declarations
-static void     frame_init (struct frame *frame);
-static struct   frame *allocate_frame (void);
+static void     frame_ctor (void *frame);
+static void     frame_acquire (struct frame *frame);
+static struct   frame *lock_page_frame (struct page_info *page_info);
+static struct   frame *allocate_frame (bool may_evict);
+static struct   frame *allocate_large_frame (uint32_t *pd, const void *upage);
+static void     *get_large_kpage (uint32_t *pd, const void *upage);
+static struct   frame *new_frame (void *kpage);
+static void     policy_remove (struct frame *frame);
+static void     policy_access (struct frame *frame);
+static void     release_frame (struct frame *frame);
+static struct   frame *take_reserved_frame (void);
+static void     pageout (void *aux UNUSED);
 static bool     load_frame (uint32_t *pd, const void *upage, bool write, bool keep_locked);
+static void     read_file_page (struct page_info *pi, struct frame *f);
+static void     fault_around (uint32_t *pd, const void *upage);
+static void     swap_in (struct page_info *pi, struct frame *f);
+static void     finish_swap_in (struct page_info *pi);
+static void     swap_read_ahead (uint32_t *pd, const void *upage, block_sector_t sector);
 static void     map_page (struct page_info *page_info, struct frame *frame, const void *upage);
-static void     wait_for_io_done (struct frame **frame);
+static struct   frame *break_cow (struct page_info *pi, struct frame *f);
 static struct   frame *lookup_read_only_frame (struct page_info *page_info);
-static void    *evict_frame (void);
-static void    *get_frame_to_evict (void);
+static void     insert_read_only_frame (struct frame *frame);
+static void     remove_read_only_frame (struct frame *frame);
+static struct   frame *evict_frame (bool wait);
+static size_t   evict_cluster (struct frame **frames, size_t cnt);
+static bool     unmap_frame (struct frame *f);
+static bool     write_back_frame (struct frame *f);
+static void     finish_eviction (struct frame *f, block_sector_t sector);
+static int      frame_upage_compare (const void *a, const void *b);
+static struct   frame *get_frame_to_evict (bool *busy);
 static unsigned frame_hash (const struct hash_elem *e, void *aux UNUSED);
 static bool     frame_less (const struct hash_elem *a, const struct hash_elem *b, void *aux UNUSED);
 
 void frametable_init (void){
-  lock_init (&frame_lock);
-  list_init (&frame_list);
-  clock_hand = list_end (&frame_list);
+  lock_init (&policy_lock);
+  policy->init ();
+  lock_init (&read_only_lock);
   hash_init (&read_only_frames, frame_hash, frame_less, NULL);
+  slab_cache_init (&frame_cache, "frame", sizeof (struct frame), frame_ctor,
+                   SLAB_KEEP);
+  lock_init (&reserve_lock);
+  list_init (&reserve_frames);
+  cond_init (&pageout_cond);
+  zero_kpage = palloc_get_page (PAL_ZERO);
+  if (zero_kpage == NULL)
+    PANIC ("could not allocate the zero page");
+}
+
+/* Selects the replacement policy called NAME.  Returns false if
+   there is no such policy.  Must be called before
+   frametable_init(). */
+bool frametable_set_policy (const char *name)
+{
+  const struct replacement_policy *p = policy_find (name);
+
+  if (p != NULL)
+    policy = p;
+  return p != NULL;
+}
+
+/* Starts the pageout thread, unless the reserve is disabled by a
+   zero high watermark.  Must be called after swap_init(). */
+void frametable_start_pageout (void)
+{
+  if (pageout_high_water < pageout_low_water)
+    pageout_high_water = pageout_low_water;
+  if (pageout_high_water == 0)
+    return;
+  pageout_started = thread_create ("pageout", PRI_DEFAULT, pageout, NULL)
+                    != TID_ERROR;
 }
 
 /* Reads data into a frame & maps the user virtual page UPAGE to it.*/
@@ -64,50 +199,46 @@ void frametable_unload_frame(uint32_t *pd, const void *upage) {
   struct page_info *pi = pagedir_get_info(pd, upage);
   if (!pi) return;
 
-  lock_acquire(&frame_lock);
-  wait_for_io_done(&pi->frame);
-
-  if (pi->frame) {
-    struct frame *f = pi->frame;
-    pi->frame = NULL;
+  struct frame *f = lock_page_frame(pi);
+  if (f) {
+    bool last = list_size(&f->page_info_list) == 1;
 
-    if (list_size(&f->page_info_list) > 1) {
-      for (struct list_elem *e = list_begin(&f->page_info_list); e != list_end(&f->page_info_list); e = list_next(e)) {
-        if (list_entry(e, struct page_info, elem) == pi) {
-          list_remove(e);
-          break;
-        }
-      }
+    if (!last) {
+      /* The front of the list is the read-only cache's key. */
+      lock_acquire(&read_only_lock);
+      list_remove(&pi->elem);
+      lock_release(&read_only_lock);
     } else {
       ASSERT(list_entry(list_begin(&f->page_info_list), struct page_info, elem) == pi);
-      if ((pi->type & PAGE_TYPE_FILE) && pi->writable == 0)
-        hash_delete(&read_only_frames, &f->hash_elem);
-      if (clock_hand == &f->list_elem)
-        clock_hand = list_next(clock_hand);
+      remove_read_only_frame(f);
+      policy_remove(f);
       list_remove(&pi->elem);
-      list_remove(&f->list_elem);
     }
-
+    pi->frame = NULL;
     pagedir_clear_page(pi->pd, upage);
-    lock_release(&frame_lock);
 
-    if (list_empty(&f->page_info_list)) {
+    if (last) {
       if ((pi->writable & WRITABLE_TO_FILE) && pagedir_is_dirty(pi->pd, upage)) {
         struct file_info *fi = &pi->data.file_info;
         off_t written = process_file_write_at(fi->file, f->kpage, size(fi->end_offset), offset(fi->end_offset));
         ASSERT(written == size(fi->end_offset));
       }
       palloc_free_page(f->kpage);
-      ASSERT(f->lock == 0);
-      free(f);
+      ASSERT(f->pin_cnt == 0);
+      lock_release(&f->lock);
+      release_frame(f);
+    } else {
+      lock_release(&f->lock);
     }
   } else {
-    lock_release(&frame_lock);
+    /* The page may be mapped to the zero page. */
+    pagedir_clear_page(pi->pd, upage);
   }
 
-  if (pi->swapped) {
+  if (pi->swapped || pi->swap_cached) {
     swap_release(pi->data.swap_sector);
     pi->swapped = false;
+    pi->swap_cached = false;
   } else if (pi->type & PAGE_TYPE_KERNEL) {
     void *kpage = (void *)pi->data.kpage;
     ASSERT(kpage);
@@ -116,7 +247,7 @@ void frametable_unload_frame(uint32_t *pd, const void *upage) {
   }
 
   pagedir_set_info(pi->pd, upage, NULL);
-  free(pi);
+  pageinfo_release(pi);
 }
 
 
@@ -132,161 +263,747 @@ bool frametable_lock_frame(uint32_t *pd, const void *upage, bool write)
 void frametable_unlock_frame(uint32_t *pd, const void *upage)
 {
   struct page_info *page_info;
+  struct frame *f;
   
   ASSERT (is_user_vaddr (upage));
   page_info = pagedir_get_info (pd, upage);
   if (page_info == NULL)
     return;
-  ASSERT (page_info->frame != NULL);
-  lock_acquire (&frame_lock);
-  page_info->frame->lock--;
-  lock_release (&frame_lock);
+  f = page_info->frame;
+  ASSERT (f != NULL);
+  lock_acquire (&f->lock);
+  f->pin_cnt--;
+  lock_release (&f->lock);
+}
+
+/* Prints frame table statistics. */
+void frametable_print_stats (void)
+{
+  printf ("Frames: %s policy, %lld evictions, %lld busy frames skipped, "
+          "%lld frame lock waits\n",
+          policy->name, evict_cnt, busy_skip_cnt, frame_wait_cnt);
+  printf ("Pageout: %lld frames evicted ahead, %lld faults served "
+          "from reserve\n", pageout_cnt, reserve_hit_cnt);
+  printf ("Swap: %lld pages read ahead, %lld writes saved by swap cache\n",
+          read_ahead_cnt, swap_cache_hit_cnt);
+  printf ("Fault-around: %lld file pages mapped\n", fault_around_cnt);
+  printf ("Fork: %lld pages shared copy-on-write, %lld copied on write\n",
+          cow_share_cnt, cow_copy_cnt);
+  printf ("Zero page: %lld read faults mapped\n", zero_map_cnt);
+  printf ("Zero fill: %lld frames pre-zeroed by the idle thread, "
+          "%lld zeroed on demand\n", prezeroed_cnt, zero_fill_cnt);
+  printf ("Large pages: %lld frames placed, %lld 4 MB ranges promoted\n",
+          large_place_cnt, large_promote_cnt);
+}
+
+/* Adds to CHILD_PD, a forked copy of PARENT's address space, a page
+   with the same contents as PARENT.  A resident page is shared with
+   the child; if it is writable, both copies are mapped read-only
+   and the first write to either gets a private copy.  Swapped pages
+   share their swap slot.  File pages refer to FILE in the child,
+   which must be the child's copy of PARENT's file.  Pages mapped
+   with mmap() are not supported.
+
+   Called by the child while the parent is blocked in fork(), so the
+   child acts as the owner of both pages.  Returns false if memory
+   allocation fails. */
+bool frametable_fork_page (struct page_info *parent, uint32_t *child_pd,
+                           struct file *file)
+{
+  struct page_info *pi;
+  struct frame *f;
+  void *kpage;
+
+  ASSERT (!(parent->writable & WRITABLE_TO_FILE));
+  pi = pageinfo_create ();
+  if (pi == NULL)
+    return false;
+  pi->type = parent->type;
+  pi->writable = parent->writable;
+  pi->pd = child_pd;
+  pi->upage = parent->upage;
+  pi->data = parent->data;
+  if (pi->type & PAGE_TYPE_FILE)
+    pi->data.file_info.file = file;
+  if (!pagedir_set_info (child_pd, pi->upage, pi))
+    {
+      pageinfo_release (pi);
+      return false;
+    }
+
+  f = lock_page_frame (parent);
+  if (f != NULL)
+    {
+      if (parent->writable)
+        {
+          parent->cow = pi->cow = true;
+          pagedir_set_writable (parent->pd, parent->upage, false);
+        }
+      if (parent->swap_cached)
+        {
+          swap_dup (parent->data.swap_sector);
+          pi->swap_cached = true;
+        }
+      pi->frame = f;
+      list_push_back (&f->page_info_list, &pi->elem);
+      pagedir_set_page (child_pd, pi->upage, f->kpage, false);
+      lock_release (&f->lock);
+      cow_share_cnt++;
+    }
+  else if (parent->swapped)
+    {
+      swap_dup (parent->data.swap_sector);
+      pi->swapped = true;
+    }
+  else if (pi->type & PAGE_TYPE_KERNEL)
+    {
+      kpage = palloc_get_page (0);
+      if (kpage == NULL)
+        {
+          pagedir_set_info (child_pd, pi->upage, NULL);
+          pageinfo_release (pi);
+          return false;
+        }
+      pg_copy (kpage, parent->data.kpage);
+      pi->data.kpage = kpage;
+    }
+  return true;
 }
 
 static bool load_frame (uint32_t *pd, const void *upage, bool write, bool keep_locked)
 {
   struct page_info *pi;
-  struct file_info *fi;
   struct frame *f = NULL;
   void *src_kpage;
-  off_t read_bytes;
-  bool ok = false;
+  block_sector_t swap_sector = 0;
+  bool swapped_in = false;
 
   ASSERT (is_user_vaddr (upage));
-  pi = pagedir_get_info (pd, upage);
+  pi = region_get_page (pd, upage);
   if (pi == NULL || (write && !pi->writable))
     return false;
 
-  lock_acquire (&frame_lock);
-  wait_for_io_done (&pi->frame);
-
-  ASSERT (pi->frame == NULL || keep_locked);
-  if (pi->frame != NULL) {
+  /* Only the owning process maps its pages, so once the frame
+     pointer is null it stays null until we map the page below. */
+  f = lock_page_frame (pi);
+  if (f != NULL) {
+    ASSERT (keep_locked || (write && pi->cow));
+    policy_access (f);
+    if (write && pi->cow) {
+      f = break_cow (pi, f);
+      if (f == NULL)
+        return false;
+    }
     if (keep_locked)
-      pi->frame->lock++;
-    lock_release (&frame_lock);
+      f->pin_cnt++;
+    lock_release (&f->lock);
+    return true;
+  }
+
+  /* A zero page is mapped to the shared zero page on a read fault
+     and gets a frame of its own on the first write, or when it is
+     pinned. */
+  if (pagedir_get_page (pd, upage) != NULL) {
+    ASSERT (pagedir_get_page (pd, upage) == zero_kpage);
+    pagedir_clear_page (pd, upage);
+  } else if (pi->type == PAGE_TYPE_ZERO && !pi->swapped
+             && !write && !keep_locked) {
+    pagedir_set_page (pd, upage, zero_kpage, false);
+    zero_map_cnt++;
     return true;
   }
 
   if ((pi->type & PAGE_TYPE_FILE) && !pi->writable) {
     f = lookup_read_only_frame (pi);
-    if (f != NULL) {
+    if (f != NULL)
       map_page (pi, f, upage);
-      f->lock++;
-      wait_for_io_done (&f);
-      f->lock--;
-      ok = true;
-    }
   }
 
   if (f == NULL) {
-    f = allocate_frame ();
-    if (f != NULL) {
-      map_page (pi, f, upage);
-      if (pi->swapped || (pi->type & PAGE_TYPE_FILE)) {
-        f->io = true;
-        f->lock++;
-        if (pi->swapped) {
-          lock_release (&frame_lock);
-          swap_read (pi->data.swap_sector, f->kpage);
-          pi->swapped = false;
-        } else {
-          if (!pi->writable)
-            hash_insert (&read_only_frames, &f->hash_elem);
-          fi = &pi->data.file_info;
-          lock_release (&frame_lock);
-          read_bytes = process_file_read_at (fi->file, f->kpage,
-                                             size (fi->end_offset),
-                                             offset (fi->end_offset));
-          ASSERT (read_bytes == size (fi->end_offset));
-        }
-        lock_acquire (&frame_lock);
-        f->lock--;
-        f->io = false;
-        cond_broadcast (&f->io_done, &frame_lock);
-      } else if (pi->type & PAGE_TYPE_KERNEL) {
-        src_kpage = (void *) pi->data.kpage;
-        ASSERT (src_kpage != NULL);
-        memcpy (f->kpage, src_kpage, PGSIZE);
-        palloc_free_page (src_kpage);
-        pi->data.kpage = NULL;
+    f = allocate_large_frame (pd, upage);
+    if (f == NULL)
+      f = allocate_frame (true);
+    if (f == NULL)
+      return false;
+    map_page (pi, f, upage);
+    if (pi->swapped) {
+      swap_sector = pi->data.swap_sector;
+      swap_in (pi, f);
+      swapped_in = true;
+    } else if (pi->type & PAGE_TYPE_FILE) {
+      read_file_page (pi, f);
+      /* From now on a writable page lives in memory or swap. */
+      if (pi->writable & WRITABLE_TO_SWAP)
         pi->type = PAGE_TYPE_ZERO;
-      }
-      ok = true;
+    } else if (pi->type & PAGE_TYPE_KERNEL) {
+      src_kpage = (void *) pi->data.kpage;
+      ASSERT (src_kpage != NULL);
+      pg_copy (f->kpage, src_kpage);
+      palloc_free_page (src_kpage);
+      pi->data.kpage = NULL;
+      pi->type = PAGE_TYPE_ZERO;
     }
   }
 
-  if (ok && keep_locked)
-    f->lock++;
+  if (keep_locked)
+    f->pin_cnt++;
+
+  lock_release (&f->lock);
+
+  if (swapped_in)
+    swap_read_ahead (pd, upage, swap_sector);
+  else if ((pi->type & PAGE_TYPE_FILE) && !pi->writable && !keep_locked)
+    fault_around (pd, upage);
+  return true;
+}
+
+/* Reads file page PI into locked frame F, adding F to the read-only
+   cache first if the page is read-only. */
+static void read_file_page (struct page_info *pi, struct frame *f)
+{
+  struct file_info *fi = &pi->data.file_info;
+  off_t read_bytes;
+
+  if (!pi->writable)
+    insert_read_only_frame (f);
+  read_bytes = process_file_read_at (fi->file, f->kpage,
+                                     size (fi->end_offset),
+                                     offset (fi->end_offset));
+  ASSERT (read_bytes == size (fi->end_offset));
+}
+
+/* Fault-around for read-only file pages.  Maps the unmapped
+   read-only file pages of PD in the aligned FAULT_AROUND_PAGES
+   window around UPAGE whose contents are already in the read-only
+   cache, which needs no I/O.  Pages in the FILE_READ_AHEAD_PAGES
+   after UPAGE that are not cached are read in as well, using only
+   frames that are free without eviction.  All of these are mapped
+   as not yet accessed.  Pages not touched before get their page_info
+   from their region, which is dropped again if the page is not
+   mapped. */
+static void fault_around (uint32_t *pd, const void *upage)
+{
+  const uint8_t *start, *p;
+  struct page_info *pi;
+  struct region *r;
+  struct frame *f;
+  bool created;
+  size_t i;
+
+  start = (const uint8_t *) ((uintptr_t) upage
+                             & ~(FAULT_AROUND_PAGES * PGSIZE - 1));
+  for (i = 0, p = start; i < FAULT_AROUND_PAGES; i++, p += PGSIZE)
+    {
+      if (p == upage || !is_user_vaddr (p))
+        continue;
+      pi = pagedir_get_info (pd, p);
+      created = pi == NULL;
+      if (created)
+        {
+          r = region_find (thread_current ()->regions, p);
+          if (r == NULL || r->writable || p - r->start >= r->read_bytes)
+            continue;
+          pi = region_get_page (pd, p);
+          if (pi == NULL)
+            continue;
+        }
+      if (pi->frame != NULL || !(pi->type & PAGE_TYPE_FILE) || pi->writable)
+        continue;
 
-  lock_release (&frame_lock);
-  return ok;
+      f = lookup_read_only_frame (pi);
+      if (f == NULL)
+        {
+          if (p >= (const uint8_t *) upage
+              && p < (const uint8_t *) upage + FILE_READ_AHEAD_PAGES * PGSIZE)
+            f = allocate_frame (false);
+          if (f == NULL)
+            {
+              if (created)
+                {
+                  pagedir_set_info (pd, p, NULL);
+                  pageinfo_release (pi);
+                }
+              continue;
+            }
+          map_page (pi, f, p);
+          read_file_page (pi, f);
+        }
+      else
+        map_page (pi, f, p);
+      pagedir_set_accessed (pd, p, false);
+      lock_release (&f->lock);
+      fault_around_cnt++;
+    }
+}
+
+/* Reads swapped page PI back into locked frame F.  The swap slot
+   is kept as a swap cache copy while swap has room, so that the
+   page can be evicted again without a write if it stays clean. */
+static void swap_in (struct page_info *pi, struct frame *f)
+{
+  swap_read (pi->data.swap_sector, f->kpage);
+  finish_swap_in (pi);
+}
+
+/* Marks PI, whose contents were just read back from swap, as
+   resident, keeping or releasing its swap slot as swap_in() does. */
+static void finish_swap_in (struct page_info *pi)
+{
+  pi->swapped = false;
+  if (swap_can_cache ())
+    pi->swap_cached = true;
+  else
+    swap_release (pi->data.swap_sector);
+}
+
+/* Swap-in read-ahead.  Reads in the pages following UPAGE in PD
+   that were swapped out to the slots following SECTOR, up to a
+   window of swap_read_ahead_pages including UPAGE, as long as free
+   frames are available without evicting anything.  The pages are
+   mapped as not yet accessed so the policy reclaims them first if
+   they go unused.  Up to SWAP_CLUSTER_PAGES of them at a time are
+   read together with swap_read_cluster(). */
+static void swap_read_ahead (uint32_t *pd, const void *upage, block_sector_t sector)
+{
+  struct page_info *pis[SWAP_CLUSTER_PAGES];
+  struct frame *frames[SWAP_CLUSTER_PAGES];
+  void *kpages[SWAP_CLUSTER_PAGES];
+  block_sector_t start;
+  struct page_info *pi;
+  struct frame *f;
+  size_t i, n, cnt;
+  bool more = true;
+
+  for (i = 1; more && i < swap_read_ahead_pages; )
+    {
+      start = sector + SECTORS_PER_PAGE;
+      for (cnt = 0; cnt < SWAP_CLUSTER_PAGES && i < swap_read_ahead_pages;
+           cnt++, i++)
+        {
+          upage += PGSIZE;
+          sector += SECTORS_PER_PAGE;
+          more = false;
+          if (!is_user_vaddr (upage))
+            break;
+
+          /* We own these pages, so a null frame pointer stays null
+             and the swap location is stable. */
+          pi = pagedir_get_info (pd, upage);
+          if (pi == NULL || pi->frame != NULL || !pi->swapped
+              || pi->data.swap_sector != sector)
+            break;
+
+          f = allocate_frame (false);
+          if (f == NULL)
+            break;
+          map_page (pi, f, upage);
+          pagedir_set_accessed (pd, upage, false);
+          pis[cnt] = pi;
+          frames[cnt] = f;
+          kpages[cnt] = f->kpage;
+          more = true;
+        }
+
+      swap_read_cluster (start, kpages, cnt);
+      for (n = 0; n < cnt; n++)
+        {
+          finish_swap_in (pis[n]);
+          lock_release (&frames[n]->lock);
+          read_ahead_cnt++;
+        }
+    }
 }
 
 
-static void frame_init (struct frame *frame)
+/* Constructs frame struct FRAME_ in frame_cache.  A released frame
+   keeps its empty page list and its lock. */
+static void frame_ctor (void *frame_)
 {
+  struct frame *frame = frame_;
+
   list_init (&frame->page_info_list);
-  cond_init (&frame->io_done);
+  lock_init (&frame->lock);
+}
+
+/* Acquires FRAME's lock, counting the acquisitions that had to wait. */
+static void frame_acquire (struct frame *frame)
+{
+  if (!lock_try_acquire (&frame->lock))
+    {
+      frame_wait_cnt++;
+      lock_acquire (&frame->lock);
+    }
 }
 
-static struct frame *allocate_frame (void)
+/* Returns the frame backing PAGE_INFO with its lock held, or a
+   null pointer if the page is not resident. */
+static struct frame *lock_page_frame (struct page_info *page_info)
 {
   struct frame *frame;
+
+  for (;;)
+    {
+      frame = page_info->frame;
+      if (frame == NULL)
+        return NULL;
+      frame_acquire (frame);
+      /* The frame may have been evicted while we waited. */
+      if (page_info->frame == frame)
+        return frame;
+      lock_release (&frame->lock);
+    }
+}
+
+/* Returns a locked frame with a zeroed page, preferring a page
+   the idle thread already zeroed.  If palloc has no free user
+   page, even after borrowing from the kernel pool, takes a frame
+   from the pageout reserve or, failing that, evicts one.  If
+   MAY_EVICT is false, returns a null pointer instead. */
+static struct frame *allocate_frame (bool may_evict)
+{
+  struct frame *frame = NULL;
   void *kpage;
   
-  kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  kpage = palloc_get_zeroed_page ();
   if (kpage != NULL)
+    prezeroed_cnt++;
+  else
     {
-      frame = calloc (1, sizeof *frame);
-      if (frame != NULL)
+      kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+      if (kpage != NULL)
+        zero_fill_cnt++;
+    }
+  if (kpage == NULL && !may_evict)
+    return NULL;
+  if (kpage == NULL)
+    {
+      frame = take_reserved_frame ();
+      return frame != NULL ? frame : evict_frame (true);
+    }
+  return new_frame (kpage);
+}
+
+/* Returns a locked frame with a zeroed page for UPAGE of PD that
+   is placed to become part of a large page, or a null pointer if
+   UPAGE is not eligible or no suitable page is free. */
+static struct frame *allocate_large_frame (uint32_t *pd, const void *upage)
+{
+  void *kpage = get_large_kpage (pd, upage);
+
+  if (kpage == NULL)
+    return NULL;
+  pg_clear (kpage);
+  zero_fill_cnt++;
+  large_place_cnt++;
+  return new_frame (kpage);
+}
+
+/* Allocates the page that UPAGE of PD has in a large page, if the
+   4 MB around UPAGE lies within a single region of the current
+   process, and returns it, not zeroed.  Returns a null pointer if
+   UPAGE is not eligible or the page is not free. */
+static void *get_large_kpage (uint32_t *pd, const void *upage)
+{
+  const uint8_t *start;
+  struct region *r;
+  uint8_t *kpage;
+  size_t ofs, i;
+
+  start = (const uint8_t *) ((uintptr_t) upage & ~(PTSPAN - 1));
+  ofs = ((const uint8_t *) upage - start) / PGSIZE;
+  if (pd != thread_current ()->pagedir)
+    return NULL;
+  r = region_find (thread_current ()->regions, start);
+  if (r == NULL || r->end < start + PTSPAN)
+    return NULL;
+
+  /* Choose the block once per 4 MB range: the one that the first
+     resident page placed in it suggests, if any.  Shared zero
+     pages and read-only copy-on-write pages are resident but were
+     not placed, so they suggest nothing. */
+  if (r->large_upage != start)
+    {
+      r->large_upage = start;
+      r->large_kpage = NULL;
+      for (i = 0; i < LARGE_PAGES; i++)
         {
-          frame_init (frame);
-          frame->kpage = kpage;
-          /* Add the frame to the end of the list so it becomes eligible 
-             for eviction. */
-          if (!list_empty (&frame_list))
-            list_insert (clock_hand, &frame->list_elem);
-          else
+          const uint8_t *p = start + i * PGSIZE;
+
+          kpage = pagedir_get_page (pd, p);
+          if (kpage != NULL && kpage != zero_kpage
+              && pagedir_is_writable (pd, p)
+              && vtop (kpage) % PTSPAN == i * PGSIZE)
             {
-              list_push_front (&frame_list, &frame->list_elem);
-              clock_hand = list_begin (&frame_list);
+              r->large_kpage = kpage - i * PGSIZE;
+              break;
             }
         }
-      else
-        palloc_free_page (kpage);
     }
-  else
-    frame = evict_frame ();
+
+  /* Stick to the block, or start a new one if its page is taken. */
+  if (r->large_kpage != NULL)
+    {
+      kpage = palloc_get_page_at (r->large_kpage + ofs * PGSIZE);
+      if (kpage != NULL)
+        return kpage;
+    }
+  kpage = palloc_get_page_in_block (LARGE_PAGES, ofs);
+  if (kpage != NULL && r->large_kpage == NULL)
+    r->large_kpage = kpage - ofs * PGSIZE;
+  return kpage;
+}
+
+/* Returns a new frame for KPAGE, locked, or a null pointer after
+   freeing KPAGE if memory is not available. */
+static struct frame *new_frame (void *kpage)
+{
+  struct frame *frame = slab_alloc (&frame_cache);
+
+  if (frame == NULL)
+    {
+      palloc_free_page (kpage);
+      return NULL;
+    }
+  lock_acquire (&frame->lock);
+  frame->kpage = kpage;
+  return frame;
+}
+
+/* Stops the policy from tracking locked FRAME. */
+static void policy_remove (struct frame *frame)
+{
+  lock_acquire (&policy_lock);
+  policy->remove (frame);
+  lock_release (&policy_lock);
+}
+
+/* Tells the policy that locked FRAME was used. */
+static void policy_access (struct frame *frame)
+{
+  lock_acquire (&policy_lock);
+  policy->access (frame);
+  lock_release (&policy_lock);
+}
+
+/* Takes a frame from the pageout reserve and returns it locked,
+   or returns a null pointer if the reserve is empty.  Wakes the
+   pageout thread if the reserve runs low. */
+static struct frame *take_reserved_frame (void)
+{
+  struct frame *frame = NULL;
+
+  if (!pageout_started)
+    return NULL;
+
+  lock_acquire (&reserve_lock);
+  if (!list_empty (&reserve_frames))
+    {
+      frame = list_entry (list_pop_front (&reserve_frames),
+                          struct frame, list_elem);
+      reserve_cnt--;
+      reserve_hit_cnt++;
+    }
+  if (reserve_cnt < pageout_low_water && !pageout_wanted)
+    {
+      pageout_wanted = true;
+      cond_signal (&pageout_cond, &reserve_lock);
+    }
+  lock_release (&reserve_lock);
+
+  if (frame != NULL)
+    lock_acquire (&frame->lock);
   return frame;
 }
 
+/* Pageout thread.  Evicts frames ahead of demand, a cluster at a
+   time, until the reserve reaches the high watermark. */
+static void pageout (void *aux UNUSED)
+{
+  struct frame *frames[SWAP_CLUSTER_PAGES];
+  size_t want, cnt, i;
+  bool full;
+
+  for (;;)
+    {
+      lock_acquire (&reserve_lock);
+      while (!pageout_wanted)
+        cond_wait (&pageout_cond, &reserve_lock);
+      lock_release (&reserve_lock);
+
+      do
+        {
+          lock_acquire (&reserve_lock);
+          want = reserve_cnt < pageout_high_water
+                 ? pageout_high_water - reserve_cnt : 0;
+          lock_release (&reserve_lock);
+          if (want > SWAP_CLUSTER_PAGES)
+            want = SWAP_CLUSTER_PAGES;
+
+          cnt = evict_cluster (frames, want);
+          for (i = 0; i < cnt; i++)
+            lock_release (&frames[i]->lock);
+          pageout_cnt += cnt;
+
+          lock_acquire (&reserve_lock);
+          for (i = 0; i < cnt; i++)
+            list_push_back (&reserve_frames, &frames[i]->list_elem);
+          reserve_cnt += cnt;
+          /* Give up until the next wakeup if nothing is evictable. */
+          full = cnt == 0 || reserve_cnt >= pageout_high_water;
+          if (full)
+            pageout_wanted = false;
+          lock_release (&reserve_lock);
+        }
+      while (!full);
+    }
+}
+
+/* Puts FRAME, which must be unlocked and no longer reachable from
+   the policy or the read-only cache, back in frame_cache. */
+static void release_frame (struct frame *frame)
+{
+  ASSERT (list_empty (&frame->page_info_list));
+  slab_free (&frame_cache, frame);
+}
+
+/* Maps UPAGE of PAGE_INFO to locked FRAME.  A frame that gets its
+   first page is handed to the replacement policy; mapping a page
+   to a frame that is already in use counts as an access to it. */
 static void map_page (struct page_info *page_info, struct frame *frame, const void *upage){
+  bool first = list_empty (&frame->page_info_list);
+
   page_info->frame = frame;
   list_push_back (&frame->page_info_list, &page_info->elem);
+  lock_acquire (&policy_lock);
+  if (first)
+    policy->insert (frame);
+  else
+    policy->access (frame);
+  lock_release (&policy_lock);
   pagedir_set_page (page_info->pd, upage, frame->kpage, page_info->writable != 0);
   pagedir_set_dirty (page_info->pd, upage, false);
   pagedir_set_accessed (page_info->pd, upage, true);
+
+  /* This may have completed a large page. */
+  if (vtop (frame->kpage) % PTSPAN == (uintptr_t) upage % PTSPAN
+      && pagedir_promote (page_info->pd, upage))
+    large_promote_cnt++;
+}
+
+/* Gives copy-on-write page PI, which shares locked frame F, a
+   writable frame of its own and returns that frame locked, with F
+   unlocked if they differ.  If PI is the last page sharing F, F
+   itself becomes writable.  Returns a null pointer, with F
+   unlocked, if no frame is available. */
+static struct frame *break_cow (struct page_info *pi, struct frame *f)
+{
+  struct frame *copy;
+
+  if (list_size (&f->page_info_list) == 1)
+    {
+      pi->cow = false;
+      pagedir_set_writable (pi->pd, pi->upage, true);
+      return f;
+    }
+
+  /* F stays locked, so the policy cannot pick it while we evict. */
+  copy = allocate_frame (true);
+  if (copy == NULL)
+    {
+      lock_release (&f->lock);
+      return NULL;
+    }
+  pg_copy (copy->kpage, f->kpage);
+  list_remove (&pi->elem);
+  pagedir_clear_page (pi->pd, pi->upage);
+  pi->cow = false;
+  if (pi->swap_cached)
+    {
+      /* The page is about to be modified. */
+      swap_release (pi->data.swap_sector);
+      pi->swap_cached = false;
+    }
+  map_page (pi, copy, pi->upage);
+  lock_release (&f->lock);
+  cow_copy_cnt++;
+  return copy;
 }
 
-static void wait_for_io_done (struct frame **frame)
+/* Evicts and returns a locked free frame.  If no frame can be
+   evicted right now, waits for one if WAIT is true and returns a
+   null pointer otherwise. */
+static struct frame *evict_frame (bool wait)
 {
-  while (*frame != NULL && (*frame)->io)
-    cond_wait (&(*frame)->io_done, &frame_lock);
+  struct frame *f;
+  block_sector_t sector = 0;
+  bool busy;
+
+  while ((f = get_frame_to_evict (&busy)) == NULL)
+    {
+      if (!wait)
+        return NULL;
+      if (!busy)
+        PANIC ("no frame available for eviction");
+      thread_yield ();
+    }
+
+  // Handle dirty page or swap-only.  The frame stays locked during the write.
+  if (unmap_frame (f))
+    {
+      if (!write_back_frame (f))
+        sector = swap_write (f->kpage);
+    }
+  finish_eviction (f, sector);
+  return f;
 }
 
-/* Evicts and returns a free frame. */
-static void * evict_frame (void)
+/* Evicts up to CNT frames, stores them locked in FRAMES and returns
+   how many were evicted.  Rather than writing each swap-backed page
+   on its own, they are sorted by process and virtual address and
+   written to a run of neighbouring swap slots, so that a later
+   swap-in can read them back together. */
+static size_t evict_cluster (struct frame **frames, size_t cnt)
 {
+  struct frame *cluster[SWAP_CLUSTER_PAGES];
+  void *kpages[SWAP_CLUSTER_PAGES];
+  block_sector_t sectors[SWAP_CLUSTER_PAGES];
   struct frame *f;
+  size_t n, swap_cnt, i;
+  bool busy;
+
+  ASSERT (cnt <= SWAP_CLUSTER_PAGES);
+  for (n = swap_cnt = 0; n < cnt; n++)
+    {
+      f = get_frame_to_evict (&busy);
+      if (f == NULL)
+        break;
+      frames[n] = f;
+      if (unmap_frame (f) && !write_back_frame (f))
+        cluster[swap_cnt++] = f;
+      else
+        finish_eviction (f, 0);
+    }
+
+  qsort (cluster, swap_cnt, sizeof *cluster, frame_upage_compare);
+  for (i = 0; i < swap_cnt; i++)
+    kpages[i] = cluster[i]->kpage;
+  swap_write_cluster (kpages, sectors, swap_cnt);
+  for (i = 0; i < swap_cnt; i++)
+    finish_eviction (cluster[i], sectors[i]);
+  return n;
+}
+
+/* Unmaps every page sharing locked frame F and takes F out of the
+   read-only cache.  Returns true if F's contents must be written
+   out before the frame can be reused. */
+static bool unmap_frame (struct frame *f)
+{
   struct page_info *pi;
-  struct file_info *fi;
-  off_t written;
-  block_sector_t sector;
   struct list_elem *e;
   bool is_dirty = false;
+  bool need_write;
 
-  f = get_frame_to_evict();
+  remove_read_only_frame (f);
 
   // Unmap and check dirty bits
   for (e = list_begin (&f->page_info_list);
@@ -297,113 +1014,232 @@ static void * evict_frame (void)
       pagedir_clear_page (pi->pd, pi->upage);  // Force page fault on next access
     }
 
-  // Handle dirty page or swap-only
-  if (is_dirty || (pi->writable & WRITABLE_TO_SWAP))
-    {
-      ASSERT (pi->writable != 0);
-      f->io = true;
-      f->lock++;
+  pi = list_entry (list_front (&f->page_info_list), struct page_info, elem);
+  ASSERT (!is_dirty || pi->writable != 0);
 
-      if (pi->writable & WRITABLE_TO_FILE)
-        {
-          fi = &pi->data.file_info;
-          lock_release (&frame_lock);
-          written = process_file_write_at (fi->file, f->kpage,
-                                           size (fi->end_offset),
-                                           offset (fi->end_offset));
-          ASSERT (written == size (fi->end_offset));
-        }
-      else
+  /* A clean page with a swap cache copy needs no write.  Once the
+     page has been modified the copy is stale.  Pages still sharing
+     a frame after fork() each hold a reference to the copy. */
+  need_write = is_dirty;
+  for (e = list_begin (&f->page_info_list);
+       e != list_end (&f->page_info_list); e = list_next (e))
+    {
+      pi = list_entry (e, struct page_info, elem);
+      if (pi->swap_cached && is_dirty)
         {
-          lock_release (&frame_lock);
-          sector = swap_write (f->kpage);
+          swap_release (pi->data.swap_sector);
+          pi->swap_cached = false;
         }
-
-      lock_acquire (&frame_lock);
-      f->lock--;
-      f->io = false;
-      cond_broadcast (&f->io_done, &frame_lock);
-    }
-  else if ((pi->type & PAGE_TYPE_FILE) && pi->writable == 0)
-    {
-      ASSERT (hash_find (&read_only_frames, &f->hash_elem) != NULL);
-      hash_delete (&read_only_frames, &f->hash_elem);
+      else if (!pi->swap_cached && (pi->writable & WRITABLE_TO_SWAP))
+        need_write = true;
     }
+  if (!need_write && pi->swap_cached)
+    swap_cache_hit_cnt++;
+  return need_write;
+}
+
+/* Writes locked frame F back to its file if its page is file
+   backed and returns true, otherwise returns false. */
+static bool write_back_frame (struct frame *f)
+{
+  struct page_info *pi;
+  struct file_info *fi;
+  off_t written;
 
-  // Finalize eviction
-  for (e = list_begin (&f->page_info_list); e != list_end (&f->page_info_list); )
+  pi = list_entry (list_front (&f->page_info_list), struct page_info, elem);
+  if (!(pi->writable & WRITABLE_TO_FILE))
+    return false;
+
+  fi = &pi->data.file_info;
+  written = process_file_write_at (fi->file, f->kpage,
+                                   size (fi->end_offset),
+                                   offset (fi->end_offset));
+  ASSERT (written == size (fi->end_offset));
+  return true;
+}
+
+/* Detaches every page from locked, unmapped frame F, recording
+   SECTOR as the swap location of swap-backed pages that had no swap
+   cache copy, and zeros the frame for reuse.  Pages that shared F
+   after fork() share the slot and are no longer copy-on-write,
+   since each will be read back into a frame of its own. */
+static void finish_eviction (struct frame *f, block_sector_t sector)
+{
+  struct page_info *pi;
+  bool sector_used = false;
+  void *kpage;
+
+  // The owner reads the swap location without locking the frame
+  // once the frame pointer is null, so set it last.
+  while (!list_empty (&f->page_info_list))
     {
-      pi = list_entry (list_front (&f->page_info_list), struct page_info, elem);
-      pi->frame = NULL;
+      pi = list_entry (list_pop_front (&f->page_info_list),
+                       struct page_info, elem);
       if (pi->writable & WRITABLE_TO_SWAP)
         {
+          if (!pi->swap_cached)
+            {
+              if (sector_used)
+                swap_dup (sector);
+              pi->data.swap_sector = sector;
+              sector_used = true;
+            }
+          pi->swap_cached = false;
           pi->swapped = true;
-          pi->data.swap_sector = sector;
         }
-      e = list_remove (e);
+      pi->cow = false;
+      barrier ();
+      pi->frame = NULL;
     }
 
-  memset (f->kpage, 0, PGSIZE);
-  return f;
+  evict_cnt++;
+
+  /* Trade the page for one the idle thread zeroed, if any.  The
+     old page goes back to palloc to be zeroed in turn. */
+  kpage = palloc_get_zeroed_page ();
+  if (kpage != NULL)
+    {
+      palloc_free_page (f->kpage);
+      f->kpage = kpage;
+      prezeroed_cnt++;
+    }
+  else
+    {
+      pg_clear (f->kpage);
+      zero_fill_cnt++;
+    }
+}
+
+/* Orders frames holding swap-backed pages by page directory and
+   then by user virtual address, for qsort(). */
+static int frame_upage_compare (const void *a_, const void *b_)
+{
+  struct frame *a = *(struct frame * const *) a_;
+  struct frame *b = *(struct frame * const *) b_;
+  const struct page_info *pa, *pb;
+
+  pa = list_entry (list_front (&a->page_info_list), struct page_info, elem);
+  pb = list_entry (list_front (&b->page_info_list), struct page_info, elem);
+  if (pa->pd != pb->pd)
+    return pa->pd < pb->pd ? -1 : 1;
+  if (pa->upage != pb->upage)
+    return pa->upage < pb->upage ? -1 : 1;
+  return 0;
 }
 
 
-/* Implementation of the clock page replacement algorithm. */ 
-static void * get_frame_to_evict (void)
+/* Asks the replacement policy for a victim.  Returns the victim
+   with its lock held, or a null pointer if no frame could be
+   evicted; *BUSY is set to whether any frame was skipped because
+   another thread held its lock. */
+static struct frame *get_frame_to_evict (bool *busy)
 {
-  struct frame *cur, *start, *victim = NULL;
-  struct page_info *pi;
-  struct list_elem *e;
-  bool accessed;
+  struct frame *victim;
 
-  ASSERT (!list_empty (&frame_list));
-  start = list_entry (clock_hand, struct frame, list_elem);
-  cur = start;
+  *busy = false;
+  lock_acquire (&policy_lock);
+  victim = policy->select (busy);
+  lock_release (&policy_lock);
+  return victim;
+}
 
-  do {
-    accessed = false;
-    ASSERT (!list_empty (&cur->page_info_list));
+/* Locks FRAME for eviction and returns true, unless it is pinned
+   or its lock is held.  A frame whose lock this thread holds is
+   being loaded by it or is an earlier victim of the same cluster.
+   Sets *BUSY if another thread holds the lock. */
+bool frame_lock_victim (struct frame *frame, bool *busy)
+{
+  if (lock_held_by_current_thread (&frame->lock))
+    return false;
+  if (!lock_try_acquire (&frame->lock))
+    {
+      busy_skip_cnt++;
+      *busy = true;
+      return false;
+    }
+  if (frame->pin_cnt > 0)
+    {
+      lock_release (&frame->lock);
+      return false;
+    }
+  return true;
+}
 
-    for (e = list_begin (&cur->page_info_list); e != list_end (&cur->page_info_list); e = list_next (e)){
+/* Returns true if locked FRAME was referenced since the last call,
+   through the accessed bit of a page mapping it or through an
+   access hint, and clears those bits. */
+bool frame_referenced (struct frame *frame)
+{
+  struct page_info *pi;
+  struct list_elem *e;
+  bool accessed = frame->referenced;
+
+  frame->referenced = false;
+  ASSERT (!list_empty (&frame->page_info_list));
+  for (e = list_begin (&frame->page_info_list);
+       e != list_end (&frame->page_info_list); e = list_next (e))
+    {
       pi = list_entry (e, struct page_info, elem);
       accessed |= pagedir_is_accessed (pi->pd, pi->upage);
       pagedir_set_accessed (pi->pd, pi->upage, false);
     }
-
-    if (!accessed && cur->lock == 0)
-      victim = cur;
-
-    clock_hand = list_next (clock_hand);
-    if (clock_hand == list_end (&frame_list))
-      clock_hand = list_begin (&frame_list);
-    cur = list_entry (clock_hand, struct frame, list_elem);
-
-  } while (!victim && cur != start);
-
-  if (victim == NULL) {
-    ASSERT (cur == start);
-    if (cur->lock > 0)
-      PANIC ("no frame available for eviction");
-
-    victim = cur;
-    clock_hand = list_next (clock_hand);
-    if (clock_hand == list_end (&frame_list))
-      clock_hand = list_begin (&frame_list);
-  }
-
-  return victim;
+  return accessed;
 }
 
 
+/* Returns the cached frame holding the same file page as
+   PAGE_INFO with its lock held, or a null pointer. */
 static struct frame * lookup_read_only_frame (struct page_info *page_info)
 {
-  struct frame frame;
+  struct frame frame, *f;
   struct hash_elem *e;
 
   list_init (&frame.page_info_list);
   list_push_back (&frame.page_info_list, &page_info->elem);
-  e = hash_find (&read_only_frames, &frame.hash_elem);
-  return e != NULL ? hash_entry (e, struct frame, hash_elem) : NULL;
+  for (;;)
+    {
+      lock_acquire (&read_only_lock);
+      e = hash_find (&read_only_frames, &frame.hash_elem);
+      lock_release (&read_only_lock);
+      if (e == NULL)
+        return NULL;
+
+      f = hash_entry (e, struct frame, hash_elem);
+      frame_acquire (f);
+      /* Evicting F takes it out of the cache under its lock, so
+         if it is still there now it stays there. */
+      lock_acquire (&read_only_lock);
+      e = hash_find (&read_only_frames, &frame.hash_elem);
+      lock_release (&read_only_lock);
+      if (e == &f->hash_elem)
+        return f;
+      lock_release (&f->lock);
+    }
+}
+
+/* Adds locked FRAME to the read-only cache.  If another thread
+   cached the same page first, FRAME stays a private copy. */
+static void insert_read_only_frame (struct frame *frame)
+{
+  lock_acquire (&read_only_lock);
+  hash_insert (&read_only_frames, &frame->hash_elem);
+  lock_release (&read_only_lock);
+}
+
+/* Removes locked FRAME from the read-only cache if it is cached. */
+static void remove_read_only_frame (struct frame *frame)
+{
+  struct page_info *pi;
+
+  pi = list_entry (list_front (&frame->page_info_list),
+                   struct page_info, elem);
+  if ((pi->type & PAGE_TYPE_FILE) && pi->writable == 0)
+    {
+      lock_acquire (&read_only_lock);
+      if (hash_find (&read_only_frames, &frame->hash_elem) == &frame->hash_elem)
+        hash_delete (&read_only_frames, &frame->hash_elem);
+      lock_release (&read_only_lock);
+    }
 }
 
 static unsigned frame_hash (const struct hash_elem *e, void *aux UNUSED)
@@ -20,17 +20,35 @@ struct frame
 {
   void *kpage;                  // Kernel virtual address for this frame
   struct list page_info_list;   // List of all page_infos sharing this frame
-  unsigned short lock;          // Lock count to prevent eviction
-  bool io;                      // Whether I/O is in progress for this frame
-  struct condition io_done;     // Condition variable for I/O completion
+  struct lock lock;             // Protects the members of this frame, held during I/O
+  unsigned short pin_cnt;       // Pin count to prevent eviction
+  uint8_t queue;                // Replacement policy queue holding the frame
+  bool referenced;              // Set by access hints, see frame_referenced()
+  bool fresh;                   // Not yet examined by the replacement policy
   struct hash_elem hash_elem;   // For insertion into read-only cache
-  struct list_elem list_elem;   // Element in global frame list
+  struct list_elem list_elem;   // Element in a policy queue or the reserve
 };
 
+/* Watermarks for the pageout thread's reserve of free frames.
+   Controlled by kernel command-line options "-pageout-low" and
+   "-pageout-high". */
+extern size_t pageout_low_water;
+extern size_t pageout_high_water;
+
+/* Pages in the swap-in read-ahead window, controlled by kernel
+   command-line option "-swap-ra". */
+extern size_t swap_read_ahead_pages;
+
 void frametable_init(void);
+bool frametable_set_policy (const char *name);
+void frametable_start_pageout (void);
 bool frametable_load_frame(uint32_t *pd, const void *upage, bool write);
 void frametable_unload_frame (uint32_t *pd, const void *upage);
 bool frametable_lock_frame(uint32_t *pd, const void *upage, bool write);
 void frametable_unlock_frame(uint32_t *pd, const void *upage);
+struct page_info;
+bool frametable_fork_page (struct page_info *parent, uint32_t *child_pd,
+                           struct file *file);
+void frametable_print_stats (void);
 
 #endif
\ No newline at end of file
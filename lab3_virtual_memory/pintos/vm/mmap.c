@@ -8,6 +8,7 @@
 #include "vm/frame.h"
 #include "vm/stack.h"
 #include "vm/page.h"
+#include "vm/region.h"
 
 static int
 allocate_md (void *upage, struct file *file, size_t num_pages);
@@ -17,13 +18,10 @@ int mmap (int fd, void *vaddr)
 {
   struct thread *cur = thread_current ();
   struct file *file = process_file_get_file (fd);
-  struct page_info *page_info;
   int md;
   off_t length;
-  off_t ofs = 0;
-  void *upage;
+  const void *end;
   size_t num_pages;
-  size_t i;
 
   if (vaddr == 0 || pg_ofs (vaddr) != 0 || fd == STDIN_FILENO
       || fd == STDOUT_FILENO || file == NULL)
@@ -34,11 +32,12 @@ int mmap (int fd, void *vaddr)
     return -1;
   
   num_pages = ((size_t) pg_round_up ((const void *) length)) / PGSIZE;
-  /* Do not allow mapping to the space reserved for the stack. */
-  for (upage = vaddr, i = 0; i < num_pages; i++, upage += PGSIZE)
-    if (pagedir_get_info (cur->pagedir, upage) != NULL
-        || is_stack_access (upage))
-      return -1;
+  end = (const uint8_t *) vaddr + num_pages * PGSIZE;
+  /* Do not allow mapping to the space reserved for the stack, or
+     over another region. */
+  if (end <= vaddr || end > MAX_STACK_SIZE
+      || region_overlaps (cur->regions, vaddr, end))
+    return -1;
   file = file_reopen (file);
   if (file == NULL)
     return -1;
@@ -48,36 +47,11 @@ int mmap (int fd, void *vaddr)
       file_close (file);
       return -1;
     }
-  /* Map in the file. */
-  for (upage = vaddr, i = 0; i < num_pages; i++, upage += PGSIZE)
-    {
-      page_info = pageinfo_create ();
-      if (page_info == NULL)
-        {
-          break;
-        }
-      if (length > PGSIZE)
-        {
-          ofs += PGSIZE;
-          length -= PGSIZE;
-        }
-      else
-        ofs += length;
-      pageinfo_set_pagedir (page_info, cur->pagedir);
-      pageinfo_set_upage (page_info, upage);
-      pageinfo_set_type (page_info, PAGE_TYPE_FILE);
-      pageinfo_set_fileinfo (page_info, file, ofs);
-      pageinfo_set_writable (page_info, WRITABLE_TO_FILE);
-      pagedir_set_info (cur->pagedir, upage, page_info);
-    }
-  if (i < num_pages)
+  /* Map in the file.  Its pages are set up as they are touched. */
+  if (!region_add (&cur->regions, vaddr, num_pages, file, 0, length,
+                   WRITABLE_TO_FILE))
     {
-      num_pages = i;
-      for (upage = vaddr, i = 0; i < num_pages; i++, upage += PGSIZE)
-        {
-          /* The frame table will free the page info and clear the entry. */
-          frametable_unload_frame (cur->pagedir, upage);
-        }
+      cur->mfiles[md].file = NULL;
       file_close (file);
       return -1;
     }
@@ -98,6 +72,7 @@ void munmap (int md)
         {
           for (upage = mmap->upage, i = 0; i < mmap->num_pages; i++, upage += PGSIZE)
             frametable_unload_frame (cur->pagedir, upage);
+          region_remove (&cur->regions, mmap->upage);
           file_close (mmap->file);
           mmap->file = NULL;
         }
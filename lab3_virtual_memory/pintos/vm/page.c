@@ -8,24 +8,33 @@
 #include "vm/page.h"
 #include "vm/swap.h"
 #include "threads/palloc.h"
-#include "threads/malloc.h"
+#include "threads/slab.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
 #include "filesys/filesys.h"
 
+/* Cache of page_infos. */
+static struct slab_cache page_info_cache;
+
+void pageinfo_init (void)
+{
+  slab_cache_init (&page_info_cache, "page_info", sizeof (struct page_info),
+                   NULL, 0);
+}
+
 struct page_info *pageinfo_create (void)
 {
   struct page_info *page_info;
   
-  page_info = calloc (1, sizeof *page_info);
+  page_info = slab_zalloc (&page_info_cache);
   return page_info;
 }
 
 void pageinfo_release (struct page_info *page_info)
 {
-  free (page_info);
+  slab_free (&page_info_cache, page_info);
 }
 
 void pageinfo_set_upage (struct page_info *page_info, const void *upage)
@@ -26,6 +26,8 @@ struct page_info
   uint32_t *pd;                     // The page directory that is mapping the page.
   const void *upage;                // The user virtual page address corresponding to the page.
   bool swapped;                     // If true the page is swapped and its contents can be read back from swap_sector.
+  bool swap_cached;                 // If true the page is resident and swap_sector still holds an identical copy.
+  bool cow;                         // If true the page is writable but shares its frame read-only with a forked process.
   struct frame *frame;              // Information about the frame backing the page.
   union
   {
@@ -37,6 +39,7 @@ struct page_info
   struct list_elem elem;
 };
 
+void pageinfo_init (void);
 struct page_info *pageinfo_create (void);
 void pageinfo_release (struct page_info *page_info);
 void pageinfo_set_upage (struct page_info *page_info, const void *upage);
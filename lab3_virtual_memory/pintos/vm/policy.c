@@ -0,0 +1,130 @@
+#include <debug.h>
+#include <stdint.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/policy.h"
+
+/* An evicted page remembered by a ghost list. */
+struct ghost
+{
+  uint32_t *pd;
+  const void *upage;
+  struct hash_elem hash_elem;
+  struct list_elem list_elem;
+};
+
+static const struct replacement_policy *policies[] =
+  {
+    &clock_policy,
+    &twoq_policy,
+    &car_policy,
+  };
+
+static void     ghost_key (struct ghost *g, struct frame *frame);
+static unsigned ghost_hash (const struct hash_elem *e, void *aux UNUSED);
+static bool     ghost_less (const struct hash_elem *a, const struct hash_elem *b,
+                            void *aux UNUSED);
+
+/* Returns the policy called NAME, or a null pointer if there is
+   none. */
+const struct replacement_policy *policy_find (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof policies / sizeof *policies; i++)
+    if (!strcmp (policies[i]->name, name))
+      return policies[i];
+  return NULL;
+}
+
+void ghost_init (struct ghost_list *ghosts)
+{
+  list_init (&ghosts->list);
+  hash_init (&ghosts->hash, ghost_hash, ghost_less, NULL);
+  ghosts->cnt = 0;
+}
+
+/* Remembers the page in FRAME, which is being evicted, as the most
+   recently evicted.  Out of memory, the page is just forgotten. */
+void ghost_add (struct ghost_list *ghosts, struct frame *frame)
+{
+  struct ghost *g = malloc (sizeof *g);
+
+  if (g == NULL)
+    return;
+  ghost_key (g, frame);
+  if (hash_insert (&ghosts->hash, &g->hash_elem) != NULL)
+    {
+      free (g);
+      return;
+    }
+  list_push_front (&ghosts->list, &g->list_elem);
+  ghosts->cnt++;
+}
+
+/* Forgets the page in FRAME and returns true if it is remembered,
+   otherwise returns false. */
+bool ghost_remove (struct ghost_list *ghosts, struct frame *frame)
+{
+  struct ghost key, *g;
+  struct hash_elem *e;
+
+  if (ghosts->cnt == 0)
+    return false;
+  ghost_key (&key, frame);
+  e = hash_delete (&ghosts->hash, &key.hash_elem);
+  if (e == NULL)
+    return false;
+  g = hash_entry (e, struct ghost, hash_elem);
+  list_remove (&g->list_elem);
+  free (g);
+  ghosts->cnt--;
+  return true;
+}
+
+/* Forgets the least recently evicted pages until at most MAX_CNT
+   are remembered. */
+void ghost_trim (struct ghost_list *ghosts, size_t max_cnt)
+{
+  struct ghost *g;
+
+  while (ghosts->cnt > max_cnt)
+    {
+      g = list_entry (list_pop_back (&ghosts->list), struct ghost, list_elem);
+      hash_delete (&ghosts->hash, &g->hash_elem);
+      free (g);
+      ghosts->cnt--;
+    }
+}
+
+/* Sets G's key to the identity of the page in FRAME. */
+static void ghost_key (struct ghost *g, struct frame *frame)
+{
+  struct page_info *pi;
+
+  ASSERT (!list_empty (&frame->page_info_list));
+  pi = list_entry (list_front (&frame->page_info_list), struct page_info, elem);
+  g->pd = pi->pd;
+  g->upage = pi->upage;
+}
+
+static unsigned ghost_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct ghost *g = hash_entry (e, struct ghost, hash_elem);
+
+  return hash_bytes (&g->pd, sizeof g->pd)
+    ^ hash_bytes (&g->upage, sizeof g->upage);
+}
+
+static bool ghost_less (const struct hash_elem *a_, const struct hash_elem *b_,
+                        void *aux UNUSED)
+{
+  const struct ghost *a = hash_entry (a_, struct ghost, hash_elem);
+  const struct ghost *b = hash_entry (b_, struct ghost, hash_elem);
+
+  if (a->pd != b->pd)
+    return a->pd < b->pd;
+  return a->upage < b->upage;
+}
@@ -0,0 +1,70 @@
+#ifndef VM_POLICY_H
+#define VM_POLICY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <hash.h>
+#include <list.h>
+
+struct frame;
+
+/* A page replacement policy, which decides the order in which
+   frames are evicted.
+
+   A frame is inserted once its first page is mapped and removed
+   when it is freed, or when the policy picks it as a victim.  All
+   functions are called with the frame table's policy lock held,
+   which serializes them.  The frame passed to insert(), access()
+   and remove() is locked by the caller.  select() must lock its
+   victim with frame_lock_victim(). */
+struct replacement_policy
+{
+  const char *name;
+
+  /* Initializes the policy's state. */
+  void (*init) (void);
+
+  /* Starts tracking FRAME, which holds a newly mapped page. */
+  void (*insert) (struct frame *frame);
+
+  /* Notes that FRAME was used by a fault or a system call, in
+     addition to what the accessed bits of its pages say. */
+  void (*access) (struct frame *frame);
+
+  /* Stops tracking FRAME, whose page is being freed. */
+  void (*remove) (struct frame *frame);
+
+  /* Picks a victim, stops tracking it and returns it locked.
+     Returns a null pointer if no frame can be evicted now, setting
+     *BUSY if some frame was skipped because another thread held
+     its lock. */
+  struct frame *(*select) (bool *busy);
+};
+
+extern const struct replacement_policy clock_policy;
+extern const struct replacement_policy twoq_policy;
+extern const struct replacement_policy car_policy;
+
+const struct replacement_policy *policy_find (const char *name);
+
+/* Helpers provided by the frame table. */
+bool frame_lock_victim (struct frame *frame, bool *busy);
+bool frame_referenced (struct frame *frame);
+
+/* History of evicted pages, most recently evicted first, that a
+   policy can use to recognize a page that comes back.  Pages are
+   identified by the page directory and address of the first page
+   that mapped the frame. */
+struct ghost_list
+{
+  struct list list;
+  struct hash hash;
+  size_t cnt;
+};
+
+void ghost_init (struct ghost_list *ghosts);
+void ghost_add (struct ghost_list *ghosts, struct frame *frame);
+bool ghost_remove (struct ghost_list *ghosts, struct frame *frame);
+void ghost_trim (struct ghost_list *ghosts, size_t max_cnt);
+
+#endif /* vm/policy.h */
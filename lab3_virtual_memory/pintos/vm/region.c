@@ -0,0 +1,265 @@
+#include <debug.h>
+#include "vm/region.h"
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+static int             height (struct region *r);
+static void            update (struct region *r);
+static struct region  *rotate_left (struct region *r);
+static struct region  *rotate_right (struct region *r);
+static struct region  *balance (struct region *r);
+static struct region  *tree_insert (struct region *root, struct region *r);
+static struct region  *tree_remove_min (struct region *root, struct region **min);
+static struct region  *tree_remove (struct region *root, const void *start,
+                                    struct region **removed);
+
+/* Adds a region of PAGE_CNT pages starting at page START to the tree
+   at *ROOT.  The first READ_BYTES bytes are read from FILE starting
+   at offset OFS, which must be page aligned, and the rest is zero.
+   WRITABLE is the page_info writable flags of its pages.  Returns
+   false if the region would overlap another one or memory
+   allocation fails. */
+bool region_add (struct region **root, const void *start, size_t page_cnt,
+                 struct file *file, off_t ofs, off_t read_bytes, int writable)
+{
+  struct region *r;
+  const uint8_t *end = (const uint8_t *) start + page_cnt * PGSIZE;
+
+  ASSERT (pg_ofs (start) == 0);
+  ASSERT (ofs % PGSIZE == 0);
+  ASSERT ((size_t) read_bytes <= page_cnt * PGSIZE);
+
+  if (page_cnt == 0 || region_overlaps (*root, start, end))
+    return false;
+  r = malloc (sizeof *r);
+  if (r == NULL)
+    return false;
+  r->start = start;
+  r->end = end;
+  r->file = file;
+  r->ofs = ofs;
+  r->read_bytes = read_bytes;
+  r->writable = writable;
+  r->large_upage = NULL;
+  r->large_kpage = NULL;
+  r->left = r->right = NULL;
+  r->height = 1;
+  *root = tree_insert (*root, r);
+  return true;
+}
+
+/* Removes and frees the region starting at START, if any.  Pages
+   already set up from it are not affected. */
+void region_remove (struct region **root, const void *start)
+{
+  struct region *r = NULL;
+
+  *root = tree_remove (*root, start, &r);
+  free (r);
+}
+
+/* Returns the region containing ADDR, or a null pointer if there is
+   none. */
+struct region *region_find (struct region *root, const void *addr)
+{
+  const uint8_t *a = addr;
+
+  while (root != NULL)
+    if (a < root->start)
+      root = root->left;
+    else if (a >= root->end)
+      root = root->right;
+    else
+      return root;
+  return NULL;
+}
+
+/* Returns true if any region overlaps the range [START, END). */
+bool region_overlaps (struct region *root, const void *start, const void *end)
+{
+  while (root != NULL)
+    if ((const uint8_t *) end <= root->start)
+      root = root->left;
+    else if ((const uint8_t *) start >= root->end)
+      root = root->right;
+    else
+      return true;
+  return false;
+}
+
+/* Calls FUNC with AUX for each region in address order, stopping and
+   returning false as soon as FUNC does. */
+bool region_for_each (struct region *root,
+                      bool (*func) (struct region *, void *aux), void *aux)
+{
+  return (root == NULL
+          || (region_for_each (root->left, func, aux)
+              && func (root, aux)
+              && region_for_each (root->right, func, aux)));
+}
+
+/* Frees all regions in the tree at *ROOT. */
+void region_destroy (struct region **root)
+{
+  struct region *r = *root;
+
+  if (r != NULL)
+    {
+      region_destroy (&r->left);
+      region_destroy (&r->right);
+      free (r);
+      *root = NULL;
+    }
+}
+
+/* Returns the page_info for page UPAGE in PD.  If the page has none
+   yet and belongs to a region of the current process, its page_info
+   is created from the region.  Returns a null pointer if UPAGE is
+   not part of the address space or memory allocation fails. */
+struct page_info *region_get_page (uint32_t *pd, const void *upage)
+{
+  struct page_info *pi;
+  struct region *r;
+  off_t page_ofs;
+
+  ASSERT (pg_ofs (upage) == 0);
+  pi = pagedir_get_info (pd, upage);
+  if (pi != NULL || pd != thread_current ()->pagedir)
+    return pi;
+  r = region_find (thread_current ()->regions, upage);
+  if (r == NULL)
+    return NULL;
+
+  pi = pageinfo_create ();
+  if (pi == NULL)
+    return NULL;
+  pageinfo_set_pagedir (pi, pd);
+  pageinfo_set_upage (pi, upage);
+  pageinfo_set_writable (pi, r->writable);
+  page_ofs = (const uint8_t *) upage - r->start;
+  if (page_ofs < r->read_bytes)
+    {
+      pageinfo_set_type (pi, PAGE_TYPE_FILE);
+      pageinfo_set_fileinfo (pi, r->file,
+                             r->ofs + (r->read_bytes - page_ofs < PGSIZE
+                                       ? r->read_bytes : page_ofs + PGSIZE));
+    }
+  else
+    pageinfo_set_type (pi, PAGE_TYPE_ZERO);
+  if (!pagedir_set_info (pd, upage, pi))
+    {
+      pageinfo_release (pi);
+      return NULL;
+    }
+  return pi;
+}
+
+static int height (struct region *r)
+{
+  return r != NULL ? r->height : 0;
+}
+
+static void update (struct region *r)
+{
+  int l = height (r->left), h = height (r->right);
+
+  r->height = (l > h ? l : h) + 1;
+}
+
+static struct region *rotate_left (struct region *r)
+{
+  struct region *p = r->right;
+
+  r->right = p->left;
+  p->left = r;
+  update (r);
+  update (p);
+  return p;
+}
+
+static struct region *rotate_right (struct region *r)
+{
+  struct region *p = r->left;
+
+  r->left = p->right;
+  p->right = r;
+  update (r);
+  update (p);
+  return p;
+}
+
+/* Restores the AVL property at R, whose subtrees differ in height
+   by at most 2, and returns the new root of the subtree. */
+static struct region *balance (struct region *r)
+{
+  int diff;
+
+  update (r);
+  diff = height (r->left) - height (r->right);
+  if (diff > 1)
+    {
+      if (height (r->left->right) > height (r->left->left))
+        r->left = rotate_left (r->left);
+      return rotate_right (r);
+    }
+  if (diff < -1)
+    {
+      if (height (r->right->left) > height (r->right->right))
+        r->right = rotate_right (r->right);
+      return rotate_left (r);
+    }
+  return r;
+}
+
+static struct region *tree_insert (struct region *root, struct region *r)
+{
+  if (root == NULL)
+    return r;
+  if (r->start < root->start)
+    root->left = tree_insert (root->left, r);
+  else
+    root->right = tree_insert (root->right, r);
+  return balance (root);
+}
+
+/* Unlinks the lowest region of the tree at ROOT into *MIN and
+   returns the new root. */
+static struct region *tree_remove_min (struct region *root, struct region **min)
+{
+  if (root->left == NULL)
+    {
+      *min = root;
+      return root->right;
+    }
+  root->left = tree_remove_min (root->left, min);
+  return balance (root);
+}
+
+/* Unlinks the region starting at START from the tree at ROOT into
+   *REMOVED and returns the new root. */
+static struct region *tree_remove (struct region *root, const void *start,
+                                   struct region **removed)
+{
+  struct region *min;
+
+  if (root == NULL)
+    return NULL;
+  if ((const uint8_t *) start < root->start)
+    root->left = tree_remove (root->left, start, removed);
+  else if ((const uint8_t *) start > root->start)
+    root->right = tree_remove (root->right, start, removed);
+  else
+    {
+      *removed = root;
+      if (root->right == NULL)
+        return root->left;
+      root->right = tree_remove_min (root->right, &min);
+      min->left = root->left;
+      min->right = root->right;
+      root = min;
+    }
+  return balance (root);
+}
@@ -0,0 +1,47 @@
+#ifndef VM_REGION_H
+#define VM_REGION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct file;
+struct page_info;
+
+/* A range of user virtual pages with the same backing, such as an
+   executable segment or a memory mapped file.  A region only says
+   what a page holds before it is first used; the page_info of a
+   page is created from it on the first fault and takes over from
+   then on.
+
+   The regions of a process are kept in an AVL tree ordered by
+   address.  Regions do not overlap. */
+struct region
+{
+  const uint8_t *start;             // First page of the region.
+  const uint8_t *end;               // Page just past the region.
+  struct file *file;                // File backing the region, if any.
+  off_t ofs;                        // Offset in FILE of START.
+  off_t read_bytes;                 // Bytes read from FILE, the rest is zero.
+  uint8_t writable;                 // WRITABLE_TO_FILE, WRITABLE_TO_SWAP or 0.
+  const uint8_t *large_upage;       // 4 MB range LARGE_KPAGE was chosen for.
+  uint8_t *large_kpage;             // Block of pages that maps it, or null.
+
+  struct region *left;              // Regions below START.
+  struct region *right;             // Regions at or above END.
+  int height;                       // Height of the subtree.
+};
+
+bool region_add (struct region **root, const void *start, size_t page_cnt,
+                 struct file *file, off_t ofs, off_t read_bytes, int writable);
+void region_remove (struct region **root, const void *start);
+struct region *region_find (struct region *root, const void *addr);
+bool region_overlaps (struct region *root, const void *start, const void *end);
+bool region_for_each (struct region *root,
+                      bool (*func) (struct region *, void *aux), void *aux);
+void region_destroy (struct region **root);
+
+struct page_info *region_get_page (uint32_t *pd, const void *upage);
+
+#endif /* vm/region.h */
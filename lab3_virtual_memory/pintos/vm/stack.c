@@ -4,17 +4,16 @@
 #include "userprog/pagedir.h"
 #include "vm/stack.h"
 #include "vm/page.h"
+#include "vm/region.h"
 
-/* The stack size cannot grow beyond 256K.*/
-#define MAX_STACK_SIZE (PHYS_BASE - PGSIZE * 64)
-  
 /* If a user program page faults on an address that might be a stack access, grow the stack by mapping in a frame. */
 void grow_stack (uint32_t *pd, const void *vaddr)
 {
   struct page_info *page_info;
   void *upage = pg_round_down (vaddr);
 
-  if (pagedir_get_info (pd, upage) == NULL && is_stack_access (vaddr))
+  if (pagedir_get_info (pd, upage) == NULL && is_stack_access (vaddr)
+      && region_find (thread_current ()->regions, upage) == NULL)
     {
       page_info = pageinfo_create ();
       if (page_info != NULL)
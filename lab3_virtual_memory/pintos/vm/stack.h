@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "threads/vaddr.h"
+
+/* The stack size cannot grow beyond 256K.*/
+#define MAX_STACK_SIZE (PHYS_BASE - PGSIZE * 64)
 
 bool is_stack_access (const void *vaddr);
 void grow_stack (uint32_t *pd, const void *vaddr);
@@ -1,70 +1,259 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <bitmap.h>
+#include <limits.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/vaddr.h"
 #include "vm/swap.h"
+#include "vm/zswap.h"
 
-#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+/* Most pages passed to the swap device in a single request. */
+#define SWAP_IO_PAGES 8
 
-static bool swap_map_allocate (block_sector_t *sectorp);
+static bool swap_map_allocate (size_t cnt, block_sector_t *sectorp);
 static void swap_map_release (block_sector_t sector);
+static void store_page (block_sector_t sector, void *kpage);
+static void read_pages (block_sector_t sector, void *const kpages[],
+                        size_t cnt);
+static void write_pages (block_sector_t sector, const void *const kpages[],
+                         size_t cnt);
+static void write_slot (size_t slot, const void *kpage);
   
 struct block *swap_device;
 /* Free map, one bit per page size sector chunk. */
 static struct bitmap *swap_map;  
+/* Number of slots in use. */
+static size_t swap_used_cnt;
+/* Number of pages referring to each slot.  A forked process shares
+   its parent's swapped pages until one of them is read back.  Wide
+   enough that every process in the system can share one slot. */
+static unsigned *swap_refs;
+/* Protects swap_map, swap_used_cnt and swap_refs. */
+static struct lock swap_lock;
 
 void swap_init(void)
 {
   ASSERT (PGSIZE % BLOCK_SECTOR_SIZE == 0);
+  lock_init (&swap_lock);
   swap_device = block_get_role (BLOCK_SWAP);
   swap_map = bitmap_create (block_size (swap_device) / SECTORS_PER_PAGE);
   if (swap_map == NULL)
     PANIC ("bitmap creation failed--swap device is too large");
+  swap_refs = calloc (bitmap_size (swap_map), sizeof *swap_refs);
+  if (swap_refs == NULL)
+    PANIC ("swap reference counts allocation failed");
+  zswap_init (bitmap_size (swap_map), write_slot);
 }
 
 /* Writes a page to swap. */
 block_sector_t swap_write (void *kpage)
 {
-  int i;
   block_sector_t sector;
   
-  if (!swap_map_allocate (&sector))
+  if (!swap_map_allocate (1, &sector))
     PANIC ("no swap space");
 
-  for (i = 0; i < SECTORS_PER_PAGE; i++, sector++, kpage += BLOCK_SECTOR_SIZE)
-    block_write (swap_device, sector, kpage);
-  return sector - SECTORS_PER_PAGE;
+  store_page (sector, kpage);
+  return sector;
 }
 
-/* Reads a page from swap. */
+/* Writes the CNT pages in KPAGES to swap and stores the sector of
+   each page in SECTORS.  The pages go to a run of neighbouring
+   slots, in order, if one is free, so that they can later be read
+   back together.  The pages the compressed tier does not take are
+   written with one request per run of neighbouring slots. */
+void swap_write_cluster (void *kpages[], block_sector_t sectors[], size_t cnt)
+{
+  const void *run[SWAP_IO_PAGES];
+  block_sector_t sector, run_sector = 0;
+  size_t run_cnt = 0;
+  size_t i;
+
+  if (cnt == 0)
+    return;
+  if (!swap_map_allocate (cnt, &sector))
+    {
+      for (i = 0; i < cnt; i++)
+        sectors[i] = swap_write (kpages[i]);
+      return;
+    }
+
+  for (i = 0; i < cnt; i++, sector += SECTORS_PER_PAGE)
+    {
+      sectors[i] = sector;
+      if (zswap_store (sector / SECTORS_PER_PAGE, kpages[i]))
+        {
+          write_pages (run_sector, run, run_cnt);
+          run_cnt = 0;
+          continue;
+        }
+      if (run_cnt == 0)
+        run_sector = sector;
+      run[run_cnt++] = kpages[i];
+      if (run_cnt == SWAP_IO_PAGES)
+        {
+          write_pages (run_sector, run, run_cnt);
+          run_cnt = 0;
+        }
+    }
+  write_pages (run_sector, run, run_cnt);
+}
+
+/* Reads a page from swap.  The slot stays allocated; the caller
+   either keeps it as a swap cache copy or releases it. */
 void swap_read (block_sector_t sector, void *kpage)
 {
-  int i;
-  
-  for (i = 0; i < SECTORS_PER_PAGE; i++, sector++, kpage += BLOCK_SECTOR_SIZE)
-    block_read (swap_device, sector, kpage);
-  swap_release (sector - SECTORS_PER_PAGE);
+  swap_read_cluster (sector, &kpage, 1);
+}
+
+/* Reads the CNT pages in the neighbouring swap slots starting at
+   SECTOR into KPAGES, in order.  The slots stay allocated, as with
+   swap_read().  The pages the compressed tier does not hold are
+   read with one request per run of neighbouring slots. */
+void swap_read_cluster (block_sector_t sector, void *kpages[], size_t cnt)
+{
+  void *run[SWAP_IO_PAGES];
+  block_sector_t run_sector = 0;
+  size_t run_cnt = 0;
+  size_t i;
+
+  for (i = 0; i < cnt; i++, sector += SECTORS_PER_PAGE)
+    {
+      if (zswap_load (sector / SECTORS_PER_PAGE, kpages[i]))
+        {
+          read_pages (run_sector, run, run_cnt);
+          run_cnt = 0;
+          continue;
+        }
+      if (run_cnt == 0)
+        run_sector = sector;
+      run[run_cnt++] = kpages[i];
+      if (run_cnt == SWAP_IO_PAGES)
+        {
+          read_pages (run_sector, run, run_cnt);
+          run_cnt = 0;
+        }
+    }
+  read_pages (run_sector, run, run_cnt);
+}
+
+/* Returns true if a page read back from swap may keep its slot.
+   Once three quarters of the slots are in use, slots are released
+   on swap-in so that cached copies cannot fill up swap. */
+bool swap_can_cache (void)
+{
+  return swap_used_cnt < bitmap_size (swap_map) / 4 * 3;
+}
+
+/* Adds a reference to the swap slot starting at SECTOR, which must
+   be in use, so that it stays allocated until one more call to
+   swap_release(). */
+void swap_dup (block_sector_t sector)
+{
+  size_t idx = sector / SECTORS_PER_PAGE;
+
+  lock_acquire (&swap_lock);
+  ASSERT (bitmap_test (swap_map, idx));
+  ASSERT (swap_refs[idx] < UINT_MAX);
+  swap_refs[idx]++;
+  lock_release (&swap_lock);
 }
 
-/* Releases a swap sector so it can be reused. */
+/* Drops a reference to a swap sector.  The slot can be reused once
+   the last reference is gone. */
 void swap_release (block_sector_t sector)
 {
   swap_map_release (sector);
 }
 
-/* Allocates one page worth of sectors and stores the starting sector in *sectorp. Returns true on success, false if no free sectors are available. */
-static bool swap_map_allocate(block_sector_t *sectorp)
+/* Allocates CNT consecutive pages worth of sectors and stores the
+   starting sector in *SECTORP.  Searches next-fit from the end of
+   the previous allocation so consecutive writes land in
+   neighbouring slots.  Returns true on success, false if no run of
+   CNT free slots is available. */
+static bool swap_map_allocate(size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t index = bitmap_scan_and_flip(swap_map, 0, 1, false);
+  lock_acquire(&swap_lock);
+  size_t index = bitmap_scan_and_flip_next(swap_map, cnt, false);
+  if (index != BITMAP_ERROR)
+    {
+      size_t i;
+
+      swap_used_cnt += cnt;
+      for (i = 0; i < cnt; i++)
+        swap_refs[index + i] = 1;
+    }
+  lock_release(&swap_lock);
   if (index != BITMAP_ERROR)
     *sectorp = index * SECTORS_PER_PAGE;
   return index != BITMAP_ERROR;
 }
 
-/* Frees the page-aligned sector block starting at SECTOR. */
+/* Drops a reference to the page-aligned sector block starting at
+   SECTOR and frees the block if it was the last. */
 static void swap_map_release(block_sector_t sector)
 {
   size_t idx = sector / SECTORS_PER_PAGE;
+  lock_acquire(&swap_lock);
   ASSERT(bitmap_all(swap_map, idx, 1));
-  bitmap_set_multiple(swap_map, idx, 1, false);
+  ASSERT(swap_refs[idx] > 0);
+  if (--swap_refs[idx] == 0)
+    {
+      zswap_invalidate (idx);
+      bitmap_set_multiple(swap_map, idx, 1, false);
+      swap_used_cnt--;
+    }
+  lock_release(&swap_lock);
+}
+
+/* Stores the page at KPAGE as the contents of the swap slot
+   starting at SECTOR, in the compressed tier if it takes the page
+   and on the swap device otherwise. */
+static void store_page(block_sector_t sector, void *kpage)
+{
+  const void *page = kpage;
+
+  if (!zswap_store (sector / SECTORS_PER_PAGE, kpage))
+    write_pages (sector, &page, 1);
+}
+
+/* Reads the CNT pages in the swap slots starting at SECTOR into
+   KPAGES, in order, as a single request to the swap device.  CNT
+   may be at most SWAP_IO_PAGES. */
+static void read_pages(block_sector_t sector, void *const kpages[],
+                       size_t cnt)
+{
+  void *buffers[SWAP_IO_PAGES * SECTORS_PER_PAGE];
+  size_t i;
+
+  ASSERT (cnt <= SWAP_IO_PAGES);
+  for (i = 0; i < cnt * SECTORS_PER_PAGE; i++)
+    buffers[i] = ((uint8_t *) kpages[i / SECTORS_PER_PAGE]
+                  + i % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+  block_read_multi (swap_device, sector, cnt * SECTORS_PER_PAGE, buffers);
+}
+
+/* Writes the CNT pages in KPAGES to the swap slots starting at
+   SECTOR, in order, as a single request to the swap device.  CNT
+   may be at most SWAP_IO_PAGES. */
+static void write_pages(block_sector_t sector, const void *const kpages[],
+                        size_t cnt)
+{
+  const void *buffers[SWAP_IO_PAGES * SECTORS_PER_PAGE];
+  size_t i;
+
+  ASSERT (cnt <= SWAP_IO_PAGES);
+  for (i = 0; i < cnt * SECTORS_PER_PAGE; i++)
+    buffers[i] = ((const uint8_t *) kpages[i / SECTORS_PER_PAGE]
+                  + i % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+  block_write_multi (swap_device, sector, cnt * SECTORS_PER_PAGE, buffers);
+}
+
+/* Writes the page at KPAGE to swap slot SLOT on the swap device,
+   for the compressed tier. */
+static void write_slot(size_t slot, const void *kpage)
+{
+  write_pages (slot * SECTORS_PER_PAGE, &kpage, 1);
 }
@@ -1,11 +1,21 @@
 #ifndef VM_SWAP_H
 #define VM_SWAP_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include "devices/block.h"
+#include "threads/vaddr.h"
+
+/* Number of sectors in one swap slot. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
 void swap_init(void);
 block_sector_t swap_write (void *kpage);
+void swap_write_cluster (void *kpages[], block_sector_t sectors[], size_t cnt);
 void swap_read (block_sector_t sector, void *kpage);
+void swap_read_cluster (block_sector_t sector, void *kpages[], size_t cnt);
+bool swap_can_cache (void);
+void swap_dup (block_sector_t sector);
 void swap_release (block_sector_t sector);
 
 #endif
\ No newline at end of file
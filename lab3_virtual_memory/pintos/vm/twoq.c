@@ -0,0 +1,154 @@
+#include <list.h>
+#include "vm/frame.h"
+#include "vm/policy.h"
+
+/* 2Q, after Johnson and Shasha, "2Q: A Low Overhead High
+   Performance Buffer Management Replacement Algorithm".
+
+   A frame first enters A1in, a FIFO whose references are ignored.
+   Pages evicted from A1in are remembered on the A1out ghost list.
+   A page that faults again while it is remembered was used twice
+   far apart, so it goes to Am, a clock of hot frames.  A large scan
+   therefore passes through A1in without disturbing Am.  A1in is
+   kept to about a quarter of the frames and A1out remembers about
+   half as many pages as there are frames. */
+
+#define QUEUE_A1IN 1
+#define QUEUE_AM 2
+
+static struct list a1in;                // FIFO of new frames, oldest first
+static size_t a1in_cnt;
+static struct list am;                  // Clock of hot frames
+static struct list_elem *am_hand;       // Next frame in am to examine
+static size_t am_cnt;
+static struct ghost_list a1out;         // Pages recently evicted from a1in
+
+static struct frame *select_a1in (bool *busy);
+static struct frame *select_am (bool *busy);
+
+static void twoq_init (void)
+{
+  list_init (&a1in);
+  list_init (&am);
+  am_hand = list_end (&am);
+  ghost_init (&a1out);
+}
+
+static void twoq_insert (struct frame *frame)
+{
+  if (ghost_remove (&a1out, frame))
+    {
+      frame->queue = QUEUE_AM;
+      if (!list_empty (&am))
+        list_insert (am_hand, &frame->list_elem);
+      else
+        {
+          list_push_front (&am, &frame->list_elem);
+          am_hand = list_begin (&am);
+        }
+      am_cnt++;
+    }
+  else
+    {
+      frame->queue = QUEUE_A1IN;
+      list_push_back (&a1in, &frame->list_elem);
+      a1in_cnt++;
+    }
+}
+
+/* References to frames on A1in are correlated with the fault that
+   brought them in, so only frames on Am take note. */
+static void twoq_access (struct frame *frame)
+{
+  if (frame->queue == QUEUE_AM)
+    frame->referenced = true;
+}
+
+static void twoq_remove (struct frame *frame)
+{
+  if (frame->queue == QUEUE_AM)
+    {
+      if (am_hand == &frame->list_elem)
+        am_hand = list_next (am_hand);
+      am_cnt--;
+    }
+  else
+    a1in_cnt--;
+  list_remove (&frame->list_elem);
+}
+
+static struct frame *twoq_select (bool *busy)
+{
+  struct frame *victim;
+
+  if (a1in_cnt > (a1in_cnt + am_cnt) / 4 || am_cnt == 0)
+    {
+      victim = select_a1in (busy);
+      if (victim == NULL)
+        victim = select_am (busy);
+    }
+  else
+    {
+      victim = select_am (busy);
+      if (victim == NULL)
+        victim = select_a1in (busy);
+    }
+  return victim;
+}
+
+/* Evicts the oldest frame on A1in that can be locked and remembers
+   its page on A1out. */
+static struct frame *select_a1in (bool *busy)
+{
+  struct list_elem *e;
+  struct frame *f;
+
+  for (e = list_begin (&a1in); e != list_end (&a1in); e = list_next (e))
+    {
+      f = list_entry (e, struct frame, list_elem);
+      if (frame_lock_victim (f, busy))
+        {
+          twoq_remove (f);
+          ghost_add (&a1out, f);
+          ghost_trim (&a1out, (a1in_cnt + am_cnt) / 2);
+          return f;
+        }
+    }
+  return NULL;
+}
+
+/* Runs the clock over Am. */
+static struct frame *select_am (bool *busy)
+{
+  struct frame *cur;
+  size_t i, n;
+
+  n = 2 * am_cnt;
+  for (i = 0; i < n; i++)
+    {
+      if (am_hand == list_end (&am))
+        am_hand = list_begin (&am);
+      cur = list_entry (am_hand, struct frame, list_elem);
+      am_hand = list_next (am_hand);
+
+      if (!frame_lock_victim (cur, busy))
+        continue;
+      if (!frame_referenced (cur))
+        {
+          twoq_remove (cur);
+          return cur;
+        }
+      lock_release (&cur->lock);
+    }
+  return NULL;
+}
+
+const struct replacement_policy twoq_policy =
+  {
+    "2q",
+    twoq_init,
+    twoq_insert,
+    twoq_access,
+    twoq_remove,
+    twoq_select,
+  };
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <debug.h>
+#include <list.h>
+#include <lz.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
+
+/* Compressed swap tier.
+
+   Pages written to swap are compressed into a pool of kernel pages
+   instead of going to the swap device, if they compress to at most
+   half a page.  Each pool page holds up to two of them, one at its
+   start and one at its end.  When the pool is full, the least
+   recently stored or loaded pages are written back to their slots
+   on the swap device to make room.  A page keeps the swap slot it
+   was given either way, so the tier is invisible above swap.c.
+
+   Compression happens outside zswap_lock, in a scratch buffer of
+   the storing thread's own, and zswap_lock is released while a page
+   is written back.  The page's compressed copy stays in the pool,
+   and loads are served from it, until the write is done; only
+   invalidating the slot, which would let it be reused, waits. */
+
+size_t zswap_pool_pages = 64;
+
+/* Largest compressed size kept, so that any two fit in a page. */
+#define ZSWAP_MAX_SIZE (PGSIZE / 2)
+
+/* A page of the pool. */
+struct zswap_page
+{
+  uint8_t *kpage;
+  struct zswap_entry *first;    // Entry stored at the start of kpage
+  struct zswap_entry *last;     // Entry stored at the end of kpage
+  struct list_elem elem;        // Element in half_pages if one is free
+};
+
+/* A compressed swap page. */
+struct zswap_entry
+{
+  size_t slot;                  // Swap slot of the page
+  size_t size;                  // Compressed size in bytes
+  struct zswap_page *page;      // Pool page holding the data
+  struct list_elem lru_elem;    // Element in lru_list unless writing
+  bool writing;                 // Being written back to the swap device
+};
+
+/* Scratch space for storing a page. */
+struct zswap_scratch
+{
+  union
+    {
+      lz_table table;           // Compressor state
+      uint8_t page[PGSIZE];     // Decompressed page being written back
+    } u;
+  uint8_t cbuf[ZSWAP_MAX_SIZE]; // Compressor output
+  struct list_elem elem;        // Element in scratch_list
+};
+
+static struct lock zswap_lock;          // Protects everything below
+static struct zswap_entry **entries;    // Entry of each swap slot, or null
+static struct list lru_list;            // Entries, most recently used first
+static struct list half_pages;          // Pool pages with one free half
+static size_t pool_page_cnt;            // Pages in the pool
+static struct list scratch_list;        // Unused scratch buffers
+static struct condition write_done;     // Signaled when a write-back ends
+static void (*write_back_slot) (size_t slot, const void *kpage);
+
+/* Statistics. */
+static long long store_cnt;             // Pages stored in the pool
+static long long reject_cnt;            // Pages that did not compress well
+static long long load_cnt;              // Swap-ins
+static long long hit_cnt;               // Swap-ins served from the pool
+static long long write_back_cnt;        // Pages written back to disk
+static long long compressed_bytes;      // Total size of stored pages
+
+static bool     place_entry (struct zswap_entry *e, size_t size);
+static uint8_t *entry_data (struct zswap_entry *e);
+static bool     write_back_oldest (struct zswap_scratch *s);
+static void     remove_entry (struct zswap_entry *e);
+static struct zswap_scratch *get_scratch (void);
+
+/* Initializes the tier for a swap device of SLOT_CNT slots.  The
+   tier writes pages back to the device with WRITE_BACK. */
+void zswap_init (size_t slot_cnt,
+                 void (*write_back) (size_t slot, const void *kpage))
+{
+  lock_init (&zswap_lock);
+  list_init (&lru_list);
+  list_init (&half_pages);
+  list_init (&scratch_list);
+  cond_init (&write_done);
+  write_back_slot = write_back;
+  if (zswap_pool_pages == 0)
+    return;
+
+  entries = calloc (slot_cnt, sizeof *entries);
+  if (entries == NULL)
+    printf ("zswap: out of memory, compressed swap disabled\n");
+}
+
+/* Stores KPAGE as the contents of swap slot SLOT.  Returns false if
+   the page must go to the swap device instead. */
+bool zswap_store (size_t slot, const void *kpage)
+{
+  struct zswap_scratch *s;
+  struct zswap_entry *e;
+  size_t size;
+  bool stored = false;
+
+  if (entries == NULL)
+    return false;
+
+  s = get_scratch ();
+  if (s == NULL)
+    return false;
+  size = lz_compress (kpage, PGSIZE, s->cbuf, sizeof s->cbuf, s->u.table);
+  e = size != 0 ? malloc (sizeof *e) : NULL;
+
+  lock_acquire (&zswap_lock);
+  ASSERT (entries[slot] == NULL);
+  if (e != NULL)
+    while (!(stored = place_entry (e, size)) && write_back_oldest (s))
+      continue;
+  if (stored)
+    {
+      e->slot = slot;
+      e->writing = false;
+      memcpy (entry_data (e), s->cbuf, size);
+      entries[slot] = e;
+      list_push_front (&lru_list, &e->lru_elem);
+      store_cnt++;
+      compressed_bytes += size;
+    }
+  else
+    {
+      free (e);
+      reject_cnt++;
+    }
+  list_push_front (&scratch_list, &s->elem);
+  lock_release (&zswap_lock);
+  return stored;
+}
+
+/* Reads swap slot SLOT into KPAGE if the pool holds it and returns
+   true, otherwise returns false.  The pool keeps its copy until the
+   slot is invalidated. */
+bool zswap_load (size_t slot, void *kpage)
+{
+  struct zswap_entry *e;
+  bool ok;
+
+  if (entries == NULL)
+    return false;
+
+  lock_acquire (&zswap_lock);
+  load_cnt++;
+  e = entries[slot];
+  if (e != NULL)
+    {
+      ok = lz_decompress (entry_data (e), e->size, kpage, PGSIZE);
+      ASSERT (ok);
+      if (!e->writing)
+        {
+          list_remove (&e->lru_elem);
+          list_push_front (&lru_list, &e->lru_elem);
+        }
+      hit_cnt++;
+    }
+  lock_release (&zswap_lock);
+  return e != NULL;
+}
+
+/* Drops the pool's copy of swap slot SLOT, if any.  Must be called
+   before the slot is reused. */
+void zswap_invalidate (size_t slot)
+{
+  struct zswap_entry *e;
+
+  if (entries == NULL)
+    return;
+
+  /* A write-back in progress must end before the slot can be
+     reused, and drops the entry itself. */
+  lock_acquire (&zswap_lock);
+  while ((e = entries[slot]) != NULL && e->writing)
+    cond_wait (&write_done, &zswap_lock);
+  if (e != NULL)
+    remove_entry (e);
+  lock_release (&zswap_lock);
+}
+
+/* Prints compressed swap statistics. */
+void zswap_print_stats (void)
+{
+  long long ratio = compressed_bytes > 0
+                    ? store_cnt * PGSIZE * 100 / compressed_bytes : 0;
+
+  printf ("Zswap: %lld pages stored, %lld rejected, %lld written back, "
+          "%lld.%02lld:1 compression\n", store_cnt, reject_cnt,
+          write_back_cnt, ratio / 100, ratio % 100);
+  printf ("Zswap: %lld of %lld swap-ins served from memory\n",
+          hit_cnt, load_cnt);
+}
+
+/* Finds room for SIZE bytes for E in the pool.  Returns false if
+   the pool is full. */
+static bool place_entry (struct zswap_entry *e, size_t size)
+{
+  struct zswap_page *p;
+
+  ASSERT (size <= ZSWAP_MAX_SIZE);
+  if (!list_empty (&half_pages))
+    {
+      p = list_entry (list_pop_front (&half_pages), struct zswap_page, elem);
+      if (p->first == NULL)
+        p->first = e;
+      else
+        p->last = e;
+    }
+  else
+    {
+      if (pool_page_cnt >= zswap_pool_pages)
+        return false;
+      p = malloc (sizeof *p);
+      if (p == NULL)
+        return false;
+      p->kpage = palloc_get_page (0);
+      if (p->kpage == NULL)
+        {
+          free (p);
+          return false;
+        }
+      p->first = e;
+      p->last = NULL;
+      list_push_front (&half_pages, &p->elem);
+      pool_page_cnt++;
+    }
+  e->page = p;
+  e->size = size;
+  return true;
+}
+
+/* Returns the address of E's compressed data. */
+static uint8_t *entry_data (struct zswap_entry *e)
+{
+  struct zswap_page *p = e->page;
+
+  return p->first == e ? p->kpage : p->kpage + PGSIZE - e->size;
+}
+
+/* Writes the least recently used page in the pool back to the swap
+   device, decompressing it into S, and drops it.  Returns false if
+   no page can be written back.  zswap_lock must be held; it is
+   released during the write. */
+static bool write_back_oldest (struct zswap_scratch *s)
+{
+  struct zswap_entry *e;
+  const uint8_t *data;
+  bool ok;
+
+  if (list_empty (&lru_list))
+    return false;
+  e = list_entry (list_pop_back (&lru_list), struct zswap_entry, lru_elem);
+  e->writing = true;
+  data = entry_data (e);
+  lock_release (&zswap_lock);
+
+  ok = lz_decompress (data, e->size, s->u.page, PGSIZE);
+  ASSERT (ok);
+  write_back_slot (e->slot, s->u.page);
+
+  lock_acquire (&zswap_lock);
+  remove_entry (e);
+  write_back_cnt++;
+  cond_broadcast (&write_done, &zswap_lock);
+  return true;
+}
+
+/* Removes E from the pool and frees it, along with its pool page
+   if that becomes empty. */
+static void remove_entry (struct zswap_entry *e)
+{
+  struct zswap_page *p = e->page;
+
+  if (!e->writing)
+    list_remove (&e->lru_elem);
+  entries[e->slot] = NULL;
+  if (p->first == e)
+    p->first = NULL;
+  else
+    p->last = NULL;
+
+  if (p->first == NULL && p->last == NULL)
+    {
+      list_remove (&p->elem);
+      palloc_free_page (p->kpage);
+      free (p);
+      pool_page_cnt--;
+    }
+  else
+    list_push_front (&half_pages, &p->elem);
+  free (e);
+}
+
+/* Returns an unused scratch buffer, allocating one if there is
+   none, or a null pointer if out of memory.  The caller puts it
+   back on scratch_list when done. */
+static struct zswap_scratch *get_scratch (void)
+{
+  struct zswap_scratch *s = NULL;
+
+  lock_acquire (&zswap_lock);
+  if (!list_empty (&scratch_list))
+    s = list_entry (list_pop_front (&scratch_list),
+                    struct zswap_scratch, elem);
+  lock_release (&zswap_lock);
+
+  return s != NULL ? s : malloc (sizeof *s);
+}
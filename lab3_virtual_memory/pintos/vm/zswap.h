@@ -0,0 +1,19 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Maximum number of kernel pages holding compressed swap pages.
+   Controlled by kernel command-line option "-zswap"; 0 disables
+   the compressed tier. */
+extern size_t zswap_pool_pages;
+
+void zswap_init (size_t slot_cnt,
+                 void (*write_back) (size_t slot, const void *kpage));
+bool zswap_store (size_t slot, const void *kpage);
+bool zswap_load (size_t slot, void *kpage);
+void zswap_invalidate (size_t slot);
+void zswap_print_stats (void);
+
+#endif /* vm/zswap.h */